@@ -0,0 +1,57 @@
+#include "arena.h"
+#include <stdlib.h>
+
+typedef struct arena_block {
+    struct arena_block *next;
+    size_t size, used;
+    /* ARENA_ALIGN-aligned, since the header is padded to a cache line */
+    _Alignas(ARENA_ALIGN) unsigned char data[];
+} arena_block_t;
+
+/*
+ * [arena_alloc] ARENA_ALIGN-aligned, uninitialized memory living until arena_free
+ *   arena: arena
+ *   size: bytes wanted
+ *
+ * Requests larger than a block get a block of their own, so big object
+ * arrays take exactly one allocation each.
+ */
+void *arena_alloc(arena_t *arena, size_t size)
+{
+    size = (size + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+
+    arena_block_t *b = arena->head;
+    if (!b || b->size - b->used < size) {
+        size_t bytes = size > ARENA_BLOCK ? size : ARENA_BLOCK;
+        b = aligned_alloc(ARENA_ALIGN, sizeof(arena_block_t) + bytes);
+        if (!b)
+            return NULL;
+        b->size = bytes;
+        b->used = 0;
+
+        // a dedicated block goes behind the current one, which may still have room
+        if (arena->head && bytes > ARENA_BLOCK) {
+            b->next = arena->head->next;
+            arena->head->next = b;
+        } else {
+            b->next = arena->head;
+            arena->head = b;
+        }
+    }
+
+    void *res = b->data + b->used;
+    b->used += size;
+    return res;
+}
+
+/* [arena_free] release every allocation of an arena at once */
+void arena_free(arena_t *arena)
+{
+    arena_block_t *b = arena->head;
+    while (b) {
+        arena_block_t *next = b->next;
+        free(b);
+        b = next;
+    }
+    arena->head = NULL;
+}
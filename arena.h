@@ -0,0 +1,24 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/* alignment of every arena allocation: one cache line */
+#define ARENA_ALIGN 64
+/* size of the blocks small allocations are carved from */
+#define ARENA_BLOCK (1 << 20)
+
+struct arena_block;
+
+/*
+ * Bump allocator: allocations are carved from a few big blocks and only ever
+ * freed all at once by arena_free. A zero-initialized arena_t is empty.
+ */
+typedef struct {
+    struct arena_block *head;
+} arena_t;
+
+void *arena_alloc(arena_t *arena, size_t size);
+void arena_free(arena_t *arena);
+
+#endif
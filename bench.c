@@ -0,0 +1,326 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <time.h>
+#include <unistd.h>
+#include "lux.h"
+#include "geometry.h"
+#include "sched.h"
+#include "walk.h"
+
+/*
+ * End-to-end render benchmark over procedural scenes. Renders a number of
+ * warm-up frames, then times each measured frame and prints one JSON object
+ * with frame time statistics and primary/shadow ray throughput.
+ */
+
+typedef struct {
+    size_t spheres, planes, walls;
+    /* point lights, 0 for the single light */
+    size_t lights;
+    uint64_t seed;
+} scene_params_t;
+
+typedef struct {
+    sphere_t *spheres;
+    plane_t *planes;
+    wall_t *walls;
+    vec3 eye, target;
+    vec3 light;
+    light_t *lights;
+} scene_t;
+
+static uint64_t rng_state;
+
+/* xorshift64*, so scenes only depend on the seed */
+static real_t rnd(real_t lo, real_t hi)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    uint64_t r = rng_state * 0x2545F4914F6CDD1DULL;
+    return lo + (hi - lo) * (real_t) ((r >> 11) * (1.0 / 9007199254740992.0));
+}
+
+static vec3 rnd_color(void)
+{
+    return (vec3) { rnd(0.2, 1.0), rnd(0.2, 1.0), rnd(0.2, 1.0) };
+}
+
+/*
+ * [scene_generate] fill a box with random objects, keeping density constant
+ *   scene: scene to fill
+ *   params: object counts and seed
+ *   lux: lux context the objects are allocated from
+ * returns -1 if the objects cannot be allocated
+ */
+static int scene_generate(scene_t *scene, scene_params_t *params, lux_t *lux)
+{
+    rng_state = params->seed ? params->seed : 1;
+
+    // the box grows with the object count so the number of objects per ray stays similar
+    real_t extent = cbrt((double) (params->spheres + params->walls + 1));
+    if (extent < 2.0) extent = 2.0;
+    real_t size = extent / cbrt((double) (params->spheres + params->walls + 1));
+
+    scene->spheres = lux_alloc(lux, sizeof(sphere_t) * (params->spheres + 1));
+    scene->planes = lux_alloc(lux, sizeof(plane_t) * (params->planes + 1));
+    scene->walls = lux_alloc(lux, sizeof(wall_t) * (params->walls + 1));
+    scene->lights = lux_alloc(lux, sizeof(light_t) * (params->lights + 1));
+    if (!scene->spheres || !scene->planes || !scene->walls || !scene->lights)
+        return -1;
+
+    for (size_t k = 0; k < params->spheres; k++) {
+        scene->spheres[k] = (sphere_t) {
+            .r = rnd(0.1, 0.4) * size,
+            .pos = { rnd(-extent, extent), rnd(0.0, extent), rnd(-extent, extent) },
+            .color = rnd_color(),
+        };
+    }
+
+    // one ground plane, the others stacked right below it
+    for (size_t k = 0; k < params->planes; k++) {
+        scene->planes[k] = (plane_t) {
+            .p = { 0.0, -0.01 * k, 0.0 },
+            .u = { 1.0, 0.0, 0.0 },
+            .v = { 0.0, 0.0, 1.0 },
+            .color = rnd_color(),
+        };
+    }
+
+    for (size_t k = 0; k < params->walls; k++) {
+        int axis = k % 3;
+        vec3 u = { axis == 0, axis == 1, axis == 2 };
+        vec3 v = { axis == 2, axis == 0, axis == 1 };
+        scene->walls[k] = (wall_t) {
+            .p = { rnd(-extent, extent), rnd(0.0, extent), rnd(-extent, extent) },
+            .u = u,
+            .v = v,
+            .color = rnd_color(),
+            .width = rnd(0.2, 0.5) * size,
+        };
+    }
+
+    scene->eye = (vec3) { 0.0, 1.5 * extent, -3.0 * extent };
+    scene->target = (vec3) { 0.0, extent / 3.0, 0.0 };
+    scene->light = (vec3) { extent, 3.0 * extent, -extent };
+
+    // enough reach that most points see a few lights, whatever their number
+    real_t reach = 2.5 * extent / cbrt((double) (params->lights + 1));
+    for (size_t k = 0; k < params->lights; k++) {
+        scene->lights[k] = (light_t) {
+            .pos = { rnd(-extent, extent), rnd(0.5, 1.5 * extent), rnd(-extent, extent) },
+            .color = rnd_color(),
+            .radius = rnd(0.5, 1.0) * reach,
+        };
+    }
+    return 0;
+}
+
+/*
+ * [bench_fail] report why a run stopped and release what it holds
+ *   lux: lux context, with its image and depth buffer
+ *   times: frame times, or NULL
+ *   what: what failed
+ * returns the exit status of a failed run
+ */
+static int bench_fail(lux_t *lux, double *times, const char *what)
+{
+    fprintf(stderr, "%s\n", what);
+    lux_destroy(lux);
+    ppm_close(lux->ppm);
+    free(lux->depth);
+    free(times);
+    return 1;
+}
+
+static job_t job_make(void *data, size_t obj_size, size_t obj_num, collide *test, bound *bounds, normal_at *normal)
+{
+    return (job_t) {
+        .data = (uint8_t*) data,
+        .obj_size = obj_size,
+        .obj_num = obj_num,
+        .test = test,
+        .bounds = bounds,
+        .normal = normal,
+    };
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double*) a, y = *(const double*) b;
+    return (x > y) - (x < y);
+}
+
+/* [percentile] nearest-rank percentile of sorted samples */
+static double percentile(double *sorted, size_t n, double p)
+{
+    size_t rank = (size_t) (p / 100.0 * n + 0.5);
+    if (rank < 1) rank = 1;
+    if (rank > n) rank = n;
+    return sorted[rank - 1];
+}
+
+static void usage(char *name)
+{
+    fprintf(stderr,
+        "usage: %s [-n spheres] [-P planes] [-W walls] [-L lights] [-r WIDTHxHEIGHT] [-t threads]\n"
+        "          [-p packet] [-a aa_samples] [-m shadow_map] [-N paths [-Q]] [-T rows|morton|hilbert] [-w warmup] [-f frames] [-s seed] [-o out.ppm]\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    scene_params_t params = { .spheres = 1000, .planes = 1, .walls = 0, .seed = 1 };
+    bool walls_set = false, wavefront = false;
+    pixel_order_t order = ORDER_ROWS;
+    size_t width = 640, height = 480;
+    size_t threads = 0, packet = 0, aa_samples = 0, shadow_map = 0, path_samples = 0;
+    size_t warmup = 1, frames = 5;
+    char *out = "/dev/null";
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:P:W:L:r:t:p:a:m:N:QT:w:f:s:o:")) != -1) {
+        switch (opt) {
+        case 'n': params.spheres = strtoul(optarg, NULL, 10); break;
+        case 'P': params.planes = strtoul(optarg, NULL, 10); break;
+        case 'W': params.walls = strtoul(optarg, NULL, 10); walls_set = true; break;
+        case 'L': params.lights = strtoul(optarg, NULL, 10); break;
+        case 'r':
+            if (sscanf(optarg, "%zux%zu", &width, &height) != 2 || !width || !height) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 't': threads = strtoul(optarg, NULL, 10); break;
+        case 'p': packet = strtoul(optarg, NULL, 10); break;
+        case 'a': aa_samples = strtoul(optarg, NULL, 10); break;
+        case 'm': shadow_map = strtoul(optarg, NULL, 10); break;
+        case 'N': path_samples = strtoul(optarg, NULL, 10); break;
+        case 'Q': wavefront = true; break;
+        case 'T':
+            if (walk_order_parse(optarg, &order) != 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'w': warmup = strtoul(optarg, NULL, 10); break;
+        case 'f': frames = strtoul(optarg, NULL, 10); break;
+        case 's': params.seed = strtoull(optarg, NULL, 10); break;
+        case 'o': out = optarg; break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (!walls_set)
+        params.walls = params.spheres / 50;
+    if (frames == 0)
+        frames = 1;
+    if (threads == 0)
+        threads = sched_default_threads();
+
+    lux_t lux = {
+        .ppm = ppm_open(out, width, height, PPM_BINARY, 0),
+        .depth = malloc(sizeof(float) * width * height),
+        .threads = threads,
+        .packet = packet,
+        .aa_samples = aa_samples,
+        .shadow_map = shadow_map,
+        .path_samples = path_samples,
+        .wavefront = wavefront,
+        .order = order,
+    };
+    if (!lux.ppm) {
+        fprintf(stderr, "cannot open %s\n", out);
+        free(lux.depth);
+        return 1;
+    }
+    if (!lux.depth)
+        return bench_fail(&lux, NULL, "cannot allocate the depth buffer");
+
+    scene_t scene;
+    if (scene_generate(&scene, &params, &lux) != 0)
+        return bench_fail(&lux, NULL, "cannot allocate the scene");
+    lux.camera = camera_build((vec3) { 0.0, 0.0, 1.0 }, scene.eye, 30.0);
+    lux.light = scene.light;
+    for (size_t k = 0; k < params.lights; k++) {
+        if (lux_add_light(&lux, &scene.lights[k]) != 0)
+            return bench_fail(&lux, NULL, "cannot add the lights");
+    }
+    camera_look_at(scene.target, &lux.camera);
+
+    job_t job;
+    int err = 0;
+    if (params.planes) {
+        job = job_make(scene.planes, sizeof(plane_t), params.planes, &test_ray_plane, NULL, &normal_plane);
+        err |= lux_submit_job(&lux, &job);
+    }
+    if (params.spheres) {
+        job = job_make(scene.spheres, sizeof(sphere_t), params.spheres, &test_ray_sphere, &bound_sphere, &normal_sphere);
+        err |= lux_submit_job(&lux, &job);
+    }
+    if (params.walls) {
+        job = job_make(scene.walls, sizeof(wall_t), params.walls, &test_ray_wall, &bound_wall, &normal_wall);
+        err |= lux_submit_job(&lux, &job);
+    }
+    if (err)
+        return bench_fail(&lux, NULL, "cannot submit the scene");
+
+    double t0 = now();
+    if (lux_commit(&lux) != 0)
+        return bench_fail(&lux, NULL, "cannot build the hierarchy");
+    double build = now() - t0;
+
+    double *times = malloc(sizeof(double) * frames);
+    if (!times)
+        return bench_fail(&lux, NULL, "cannot allocate the frame times");
+    uint64_t primary = 0, shadow = 0;
+    double total = 0.0;
+
+    for (size_t f = 0; f < warmup + frames; f++) {
+        for (size_t k = 0; k < width * height; k++)
+            lux.depth[k] = FLT_MAX;
+
+        t0 = now();
+        if (lux_render(&lux) != 0)
+            return bench_fail(&lux, times, "cannot render");
+        double dt = now() - t0;
+
+        if (f < warmup)
+            continue;
+        times[f - warmup] = dt;
+        total += dt;
+        primary += lux.primary_rays;
+        shadow += lux.shadow_rays;
+    }
+
+    qsort(times, frames, sizeof(double), cmp_double);
+
+    printf("{\"precision\": \"%s\", \"spheres\": %zu, \"planes\": %zu, \"walls\": %zu, \"lights\": %zu, \"seed\": %llu, "
+           "\"width\": %zu, \"height\": %zu, \"threads\": %zu, \"packet\": %zu, \"aa_samples\": %zu, \"shadow_map\": %zu, \"paths\": %zu, \"wavefront\": %s, \"order\": \"%s\", "
+           "\"warmup\": %zu, \"frames\": %zu, \"build_ms\": %.3f, "
+           "\"frame_ms\": {\"median\": %.3f, \"p99\": %.3f, \"min\": %.3f, \"max\": %.3f, \"mean\": %.3f}, "
+           "\"mrays_per_s\": {\"primary\": %.3f, \"shadow\": %.3f, \"total\": %.3f}}\n",
+           sizeof(real_t) == sizeof(float) ? "float" : "double",
+           params.spheres, params.planes, params.walls, params.lights, (unsigned long long) params.seed,
+           width, height, threads, packet, aa_samples, shadow_map, path_samples, wavefront ? "true" : "false", walk_order_name(order), warmup, frames, build * 1e3,
+           percentile(times, frames, 50.0) * 1e3, percentile(times, frames, 99.0) * 1e3,
+           times[0] * 1e3, times[frames - 1] * 1e3, total / frames * 1e3,
+           primary / total * 1e-6, shadow / total * 1e-6, (primary + shadow) / total * 1e-6);
+
+    // frees the job table and every object at once
+    lux_destroy(&lux);
+    ppm_close(lux.ppm);
+    free(lux.depth);
+    free(times);
+
+    return 0;
+}
@@ -0,0 +1,789 @@
+#include "bvh.h"
+#include <stdlib.h>
+#include <math.h>
+#include <float.h>
+#include "geometry.h"
+#include "stats.h"
+
+/*
+ * Bounding volume hierarchy over every bounded object of every submitted job,
+ * built top-down with the binned surface area heuristic. Nodes are stored in
+ * depth-first order, so the left child of a node directly follows it.
+ *
+ * Jobs without a bounds function (infinite planes) stay on a side list that is
+ * tested linearly on every query.
+ *
+ * Spheres are moved to the front of their leaf, followed by triangles, and both
+ * are copied into packed storage so a whole leaf of either is tested with one
+ * sphere_intersect or triangle_intersect call. The copy is taken at build
+ * time: sphere and mesh jobs modified afterwards need a new build.
+ */
+
+#define BVH_BINS 16
+/* a leaf of spheres or triangles fits one kernel call */
+#define BVH_LEAF_MAX KERNEL_LANES
+/* past this depth nodes are split in half by count, which bounds tree height */
+#define BVH_SAH_DEPTH 32
+#define BVH_STACK 96
+
+typedef struct {
+    bvh_t *bvh;
+    aabb_t *boxes;
+    vec3 *centroids;
+} builder_t;
+
+////////////////////////////////////
+// BOXES
+////////////////////////////////////
+
+static inline real_t vec3_at(vec3 v, int axis)
+{
+    return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
+
+static inline aabb_t aabb_empty(void)
+{
+    return (aabb_t) {
+        .min = { REAL_MAX, REAL_MAX, REAL_MAX },
+        .max = { -REAL_MAX, -REAL_MAX, -REAL_MAX },
+    };
+}
+
+static inline void aabb_grow(aabb_t *a, aabb_t b)
+{
+    a->min.x = real_min(a->min.x, b.min.x);
+    a->min.y = real_min(a->min.y, b.min.y);
+    a->min.z = real_min(a->min.z, b.min.z);
+    a->max.x = real_max(a->max.x, b.max.x);
+    a->max.y = real_max(a->max.y, b.max.y);
+    a->max.z = real_max(a->max.z, b.max.z);
+}
+
+static inline void aabb_grow_point(aabb_t *a, vec3 p)
+{
+    aabb_grow(a, (aabb_t) { .min = p, .max = p });
+}
+
+static inline double aabb_area(aabb_t a)
+{
+    if (a.max.x < a.min.x)
+        return 0.0;
+    double dx = a.max.x - a.min.x;
+    double dy = a.max.y - a.min.y;
+    double dz = a.max.z - a.min.z;
+    return 2.0 * (dx * dy + dy * dz + dz * dx);
+}
+
+#ifdef LUX_FLOAT
+#define BVH_PAD 1e-4
+#else
+#define BVH_PAD 1e-6
+#endif
+
+/* widen a box by a relative epsilon so rounding in the object tests never escapes it */
+static inline void aabb_pad(aabb_t *a)
+{
+    a->min.x -= BVH_PAD * (real_abs(a->min.x) + real_abs(a->max.x)) + 1e-9;
+    a->min.y -= BVH_PAD * (real_abs(a->min.y) + real_abs(a->max.y)) + 1e-9;
+    a->min.z -= BVH_PAD * (real_abs(a->min.z) + real_abs(a->max.z)) + 1e-9;
+    a->max.x += BVH_PAD * (real_abs(a->min.x) + real_abs(a->max.x)) + 1e-9;
+    a->max.y += BVH_PAD * (real_abs(a->min.y) + real_abs(a->max.y)) + 1e-9;
+    a->max.z += BVH_PAD * (real_abs(a->min.z) + real_abs(a->max.z)) + 1e-9;
+}
+
+/*
+ * [ray_box] slab test of a ray against a box
+ *   b: box
+ *   o: ray origin
+ *   inv: componentwise inverse of the ray direction
+ *   tmax: ignore intersections further than this
+ *   tnear: where to write the entry distance
+ */
+static inline bool ray_box(const aabb_t *b, vec3 o, vec3 inv, real_t tmax, real_t *tnear)
+{
+    real_t lo = 0.0, hi = tmax;
+    real_t t0, t1;
+
+    // comparisons are written so that NaN slabs (0 * inf) are ignored
+    t0 = (b->min.x - o.x) * inv.x; t1 = (b->max.x - o.x) * inv.x;
+    if (t0 > t1) { real_t t = t0; t0 = t1; t1 = t; }
+    if (t0 > lo) lo = t0;
+    if (t1 < hi) hi = t1;
+
+    t0 = (b->min.y - o.y) * inv.y; t1 = (b->max.y - o.y) * inv.y;
+    if (t0 > t1) { real_t t = t0; t0 = t1; t1 = t; }
+    if (t0 > lo) lo = t0;
+    if (t1 < hi) hi = t1;
+
+    t0 = (b->min.z - o.z) * inv.z; t1 = (b->max.z - o.z) * inv.z;
+    if (t0 > t1) { real_t t = t0; t0 = t1; t1 = t; }
+    if (t0 > lo) lo = t0;
+    if (t1 < hi) hi = t1;
+
+    *tnear = lo;
+    return lo <= hi;
+}
+
+////////////////////////////////////
+// BUILD
+////////////////////////////////////
+
+static void swap_refs(builder_t *b, size_t i, size_t j)
+{
+    bvh_ref_t r = b->bvh->refs[i];
+    b->bvh->refs[i] = b->bvh->refs[j];
+    b->bvh->refs[j] = r;
+
+    aabb_t box = b->boxes[i];
+    b->boxes[i] = b->boxes[j];
+    b->boxes[j] = box;
+
+    vec3 c = b->centroids[i];
+    b->centroids[i] = b->centroids[j];
+    b->centroids[j] = c;
+}
+
+static void make_leaf(bvh_node_t *node, size_t first, size_t count)
+{
+    node->first = first;
+    node->count = count;
+    node->axis = 0;
+    node->spheres = 0;
+    node->triangles = 0;
+}
+
+static inline bool is_sphere(bvh_t *bvh, bvh_ref_t ref)
+{
+    return bvh->jobs[ref.job].kind == JOB_SPHERE;
+}
+
+static inline bool is_triangle(bvh_t *bvh, bvh_ref_t ref)
+{
+    return bvh->jobs[ref.job].kind == JOB_TRIANGLE;
+}
+
+static inline void *ref_data(bvh_t *bvh, bvh_ref_t ref)
+{
+    const job_t *job = &bvh->jobs[ref.job];
+    return job->data + ref.obj * job->obj_size;
+}
+
+/*
+ * [pack_leaves] order each leaf as spheres, triangles, other objects and copy
+ * the spheres and triangles into packed storage
+ */
+static int pack_leaves(bvh_t *bvh)
+{
+    bool triangles = false;
+    for (size_t k = 0; k < bvh->job_num; k++)
+        triangles = triangles || (bvh->jobs[k].kind == JOB_TRIANGLE && bvh->jobs[k].obj_num);
+
+    if (sphere_soa_init(&bvh->spheres, bvh->ref_num) != 0
+        || (triangles && triangle_soa_init(&bvh->triangles, bvh->ref_num) != 0))
+        return -1;
+
+    for (size_t n = 0; n < bvh->node_num; n++) {
+        bvh_node_t *node = &bvh->nodes[n];
+        if (node->count == 0)
+            continue;
+
+        // stable partition, so refs keep their relative order
+        bvh_ref_t tris[BVH_LEAF_MAX], rest[BVH_LEAF_MAX];
+        size_t nrest = 0;
+        for (size_t k = node->first; k < node->first + node->count; k++) {
+            bvh_ref_t ref = bvh->refs[k];
+            if (is_sphere(bvh, ref)) {
+                size_t at = node->first + node->spheres++;
+                bvh->refs[at] = ref;
+                sphere_soa_set(&bvh->spheres, at, (sphere_t*) ref_data(bvh, ref));
+            } else if (is_triangle(bvh, ref)) {
+                tris[node->triangles++] = ref;
+            } else {
+                rest[nrest++] = ref;
+            }
+        }
+        for (size_t k = 0; k < node->triangles; k++) {
+            size_t at = node->first + node->spheres + k;
+            bvh->refs[at] = tris[k];
+            triangle_soa_set(&bvh->triangles, at, (triangle_t*) ref_data(bvh, tris[k]));
+        }
+        for (size_t k = 0; k < nrest; k++)
+            bvh->refs[node->first + node->spheres + node->triangles + k] = rest[k];
+    }
+
+    return 0;
+}
+
+/*
+ * [build_node] build the subtree for refs [first, first + count)
+ *   b: builder state
+ *   n: index of the node to fill
+ *   first, count: range of refs covered by the node
+ *   depth: depth of the node
+ */
+static void build_node(builder_t *b, size_t n, size_t first, size_t count, size_t depth)
+{
+    bvh_t *bvh = b->bvh;
+    aabb_t box = aabb_empty(), cbox = aabb_empty();
+    for (size_t k = first; k < first + count; k++) {
+        aabb_grow(&box, b->boxes[k]);
+        aabb_grow_point(&cbox, b->centroids[k]);
+    }
+    bvh->nodes[n].box = box;
+
+    if (count <= 2) {
+        make_leaf(&bvh->nodes[n], first, count);
+        return;
+    }
+
+    // pick the axis with the widest centroid spread
+    int axis = 0;
+    double extent = cbox.max.x - cbox.min.x;
+    if (cbox.max.y - cbox.min.y > extent) { axis = 1; extent = cbox.max.y - cbox.min.y; }
+    if (cbox.max.z - cbox.min.z > extent) { axis = 2; extent = cbox.max.z - cbox.min.z; }
+
+    size_t mid = first + count / 2;
+    if (extent > 0.0 && depth < BVH_SAH_DEPTH) {
+        // bin centroids and sweep the bin boundaries for the cheapest split
+        aabb_t bins[BVH_BINS];
+        size_t counts[BVH_BINS] = { 0 };
+        double lo = vec3_at(cbox.min, axis);
+        double scale = BVH_BINS / extent;
+        for (int k = 0; k < BVH_BINS; k++)
+            bins[k] = aabb_empty();
+        for (size_t k = first; k < first + count; k++) {
+            int bin = (int) ((vec3_at(b->centroids[k], axis) - lo) * scale);
+            if (bin >= BVH_BINS) bin = BVH_BINS - 1;
+            counts[bin]++;
+            aabb_grow(&bins[bin], b->boxes[k]);
+        }
+
+        double right_area[BVH_BINS];
+        size_t right_count[BVH_BINS];
+        aabb_t acc = aabb_empty();
+        size_t acc_n = 0;
+        for (int k = BVH_BINS - 1; k > 0; k--) {
+            aabb_grow(&acc, bins[k]);
+            acc_n += counts[k];
+            right_area[k] = aabb_area(acc);
+            right_count[k] = acc_n;
+        }
+
+        double best_cost = DBL_MAX;
+        int best_bin = -1;
+        acc = aabb_empty();
+        acc_n = 0;
+        for (int k = 1; k < BVH_BINS; k++) {
+            aabb_grow(&acc, bins[k - 1]);
+            acc_n += counts[k - 1];
+            if (acc_n == 0 || right_count[k] == 0)
+                continue;
+            double cost = aabb_area(acc) * acc_n + right_area[k] * right_count[k];
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_bin = k;
+            }
+        }
+
+        // relative cost of traversing one node versus testing one object is 1
+        double leaf_cost = (double) count;
+        double area = aabb_area(box);
+        double split_cost = area > 0.0 ? 1.0 + best_cost / area : DBL_MAX;
+        if (split_cost >= leaf_cost && count <= BVH_LEAF_MAX) {
+            make_leaf(&bvh->nodes[n], first, count);
+            return;
+        }
+
+        if (best_bin > 0) {
+            // partition refs around the chosen bin boundary
+            size_t i = first, j = first + count;
+            while (i < j) {
+                int bin = (int) ((vec3_at(b->centroids[i], axis) - lo) * scale);
+                if (bin >= BVH_BINS) bin = BVH_BINS - 1;
+                if (bin < best_bin)
+                    i++;
+                else
+                    swap_refs(b, i, --j);
+            }
+            mid = i;
+        }
+    } else if (count <= BVH_LEAF_MAX) {
+        make_leaf(&bvh->nodes[n], first, count);
+        return;
+    }
+
+    // children are allocated in depth-first order, so the left one is always n + 1
+    bvh->nodes[n].count = 0;
+    bvh->nodes[n].axis = axis;
+
+    size_t left = bvh->node_num++;
+    build_node(b, left, first, mid - first, depth + 1);
+
+    size_t right = bvh->node_num++;
+    bvh->nodes[n].first = right;
+    build_node(b, right, mid, first + count - mid, depth + 1);
+}
+
+/*
+ * [bvh_build] build a hierarchy over a table of jobs
+ *   jobs: jobs in submission order, copied into the hierarchy
+ *   job_num: number of jobs
+ * returns NULL if memory runs out
+ */
+bvh_t *bvh_build(const job_t *jobs, size_t job_num)
+{
+    static uint64_t builds = 0;
+    bvh_t *bvh = calloc(1, sizeof(bvh_t));
+    const job_t *job;
+
+    if (!bvh)
+        return NULL;
+    bvh->id = __atomic_add_fetch(&builds, 1, __ATOMIC_RELAXED);
+
+    // traversal reads job headers for every object it tests: keep them on as few lines as possible
+    size_t bytes = (sizeof(job_t) * (job_num + 1) + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+    bvh->job_num = job_num;
+    bvh->jobs = aligned_alloc(ARENA_ALIGN, bytes);
+    bvh->unbounded = malloc(sizeof(uint32_t) * (job_num + 1));
+    if (!bvh->jobs || !bvh->unbounded) {
+        bvh_free(bvh);
+        return NULL;
+    }
+
+    size_t k;
+    for (k = 0; k < job_num; k++) {
+        job = &jobs[k];
+        bvh->jobs[k] = *job;
+        if (job->bounds)
+            bvh->ref_num += job->obj_num;
+        else
+            bvh->unbounded[bvh->unbounded_num++] = k;
+    }
+
+    if (bvh->ref_num == 0)
+        return bvh;
+
+    builder_t b = {
+        .bvh = bvh,
+        .boxes = malloc(sizeof(aabb_t) * bvh->ref_num),
+        .centroids = malloc(sizeof(vec3) * bvh->ref_num),
+    };
+    bvh->refs = malloc(sizeof(bvh_ref_t) * bvh->ref_num);
+    // a binary tree with at most ref_num leaves has fewer than 2 * ref_num nodes
+    bvh->nodes = malloc(sizeof(bvh_node_t) * 2 * bvh->ref_num);
+    if (!b.boxes || !b.centroids || !bvh->refs || !bvh->nodes) {
+        free(b.boxes);
+        free(b.centroids);
+        bvh_free(bvh);
+        return NULL;
+    }
+
+    size_t r = 0;
+    for (k = 0; k < bvh->job_num; k++) {
+        job = &bvh->jobs[k];
+        if (!job->bounds)
+            continue;
+        for (size_t o = 0; o < job->obj_num; o++, r++) {
+            bvh->refs[r] = (bvh_ref_t) { .job = k, .obj = o };
+            job->bounds(job->data + o * job->obj_size, &b.boxes[r]);
+            aabb_pad(&b.boxes[r]);
+            vec3_add(b.boxes[r].min, b.boxes[r].max, &b.centroids[r]);
+            vec3_mul(b.centroids[r], 0.5, &b.centroids[r]);
+        }
+    }
+
+    bvh->node_num = 1;
+    build_node(&b, 0, 0, bvh->ref_num, 0);
+    // shrinking may fail and keep the old block, which is still good
+    bvh_node_t *nodes = realloc(bvh->nodes, sizeof(bvh_node_t) * bvh->node_num);
+    if (nodes)
+        bvh->nodes = nodes;
+
+    free(b.boxes);
+    free(b.centroids);
+
+    kernels_init();
+    if (pack_leaves(bvh) != 0) {
+        bvh_free(bvh);
+        return NULL;
+    }
+
+    return bvh;
+}
+
+void bvh_free(bvh_t *bvh)
+{
+    if (!bvh)
+        return;
+    free(bvh->jobs);
+    free(bvh->unbounded);
+    free(bvh->nodes);
+    free(bvh->refs);
+    sphere_soa_free(&bvh->spheres);
+    triangle_soa_free(&bvh->triangles);
+    free(bvh);
+}
+
+////////////////////////////////////
+// TRAVERSAL
+////////////////////////////////////
+
+static inline vec3 ray_inverse(vec3 ray)
+{
+    return (vec3) { (real_t) 1 / ray.x, (real_t) 1 / ray.y, (real_t) 1 / ray.z };
+}
+
+#ifdef LUX_STATS
+/* [count_packed] count the tests and hits of one kernel call on refs [first, first + n); t and max_t filter hits if t is given */
+static void count_packed(bvh_t *bvh, size_t first, size_t n, unsigned mask, float *t, real_t max_t)
+{
+    for (size_t k = 0; k < n; k++) {
+        uint32_t j = bvh->refs[first + k].job;
+        STATS_TEST(j, 1);
+        if ((mask & (1u << k)) && (!t || t[k] < max_t))
+            STATS_HIT(j);
+    }
+}
+#endif
+
+static inline void test_object(bvh_t *bvh, uint32_t j, uint32_t o, vec3 source, vec3 ray, hit_t *hit)
+{
+    const job_t *job = &bvh->jobs[j];
+    collision_t col;
+    STATS_TEST(j, 1);
+    if (intersect_object(job->kind, job, source, ray, job->data + o * job->obj_size, &col)) {
+        STATS_HIT(j);
+        hit_update(hit, &col, j, o);
+    }
+}
+
+/* [nearest_job_as] test a ray against every object of job j, of type kind */
+static inline __attribute__((always_inline))
+void nearest_job_as(bvh_t *bvh, uint32_t j, job_kind_t kind, vec3 source, vec3 ray, hit_t *hit)
+{
+    const job_t *job = &bvh->jobs[j];
+    collision_t col;
+    STATS_TEST(j, job->obj_num);
+    for (size_t o = 0; o < job->obj_num; o++) {
+        if (intersect_object(kind, job, source, ray, job->data + o * job->obj_size, &col)) {
+            STATS_HIT(j);
+            hit_update(hit, &col, j, o);
+        }
+    }
+}
+
+/* [nearest_job] test a ray against every object of job j, with one loop per primitive type */
+static void nearest_job(bvh_t *bvh, uint32_t j, vec3 source, vec3 ray, hit_t *hit)
+{
+    switch (bvh->jobs[j].kind) {
+    case JOB_PLANE: nearest_job_as(bvh, j, JOB_PLANE, source, ray, hit); break;
+    case JOB_WALL: nearest_job_as(bvh, j, JOB_WALL, source, ray, hit); break;
+    case JOB_SPHERE: nearest_job_as(bvh, j, JOB_SPHERE, source, ray, hit); break;
+    case JOB_TRIANGLE: nearest_job_as(bvh, j, JOB_TRIANGLE, source, ray, hit); break;
+    default: nearest_job_as(bvh, j, JOB_GENERIC, source, ray, hit); break;
+    }
+}
+
+/* [nearest_triangles] test a ray against packed triangles [first, first + n) with one kernel call */
+static inline void nearest_triangles(bvh_t *bvh, size_t first, size_t n, vec3 source, vec3 ray, hit_t *hit)
+{
+    float t[KERNEL_LANES];
+    unsigned mask = triangle_intersect(&bvh->triangles, first, n, source, ray, t);
+    STATS(count_packed(bvh, first, n, mask, NULL, 0));
+    for (size_t k = 0; mask; k++, mask >>= 1) {
+        if (!(mask & 1))
+            continue;
+        bvh_ref_t ref = bvh->refs[first + k];
+        collision_t col = {
+            .color = ((triangle_t*) ref_data(bvh, ref))->mesh->color,
+            .depth = t[k],
+        };
+        hit_update(hit, &col, ref.job, ref.obj);
+    }
+}
+
+/*
+ * [bvh_nearest] find the nearest object along a ray
+ *   bvh: hierarchy
+ *   source: ray origin
+ *   ray: normalized ray direction
+ *   hit: in: hit->col.depth bounds the search and hit->job is LUX_NO_HIT;
+ *        out: nearest collision found, if any
+ */
+bool bvh_nearest(bvh_t *bvh, vec3 source, vec3 ray, hit_t *hit)
+{
+    for (size_t u = 0; u < bvh->unbounded_num; u++)
+        nearest_job(bvh, bvh->unbounded[u], source, ray, hit);
+
+    if (bvh->node_num == 0)
+        return hit->job != LUX_NO_HIT;
+
+    vec3 inv = ray_inverse(ray);
+    bool neg[3] = { ray.x < 0.0, ray.y < 0.0, ray.z < 0.0 };
+    uint32_t stack[BVH_STACK];
+    size_t top = 0;
+    stack[top++] = 0;
+
+    while (top > 0) {
+        bvh_node_t *node = &bvh->nodes[stack[--top]];
+        // depths are stored as floats: leave some slack so equal-depth ties are still visited
+        real_t limit = hit->col.depth + 1e-6 * hit->col.depth;
+        real_t tnear;
+        if (!ray_box(&node->box, source, inv, limit, &tnear))
+            continue;
+
+        if (node->count > 0) {
+            if (node->spheres > 0) {
+                float t[KERNEL_LANES];
+                unsigned mask = sphere_intersect(&bvh->spheres, node->first, node->spheres, source, ray, t);
+                STATS(count_packed(bvh, node->first, node->spheres, mask, NULL, 0));
+                for (size_t k = 0; mask; k++, mask >>= 1) {
+                    if (!(mask & 1))
+                        continue;
+                    size_t at = node->first + k;
+                    collision_t col = {
+                        .color = { bvh->spheres.cr[at], bvh->spheres.cg[at], bvh->spheres.cb[at] },
+                        .depth = t[k],
+                    };
+                    hit_update(hit, &col, bvh->refs[at].job, bvh->refs[at].obj);
+                }
+            }
+            if (node->triangles > 0)
+                nearest_triangles(bvh, node->first + node->spheres, node->triangles, source, ray, hit);
+            for (size_t k = node->first + node->spheres + node->triangles; k < node->first + node->count; k++)
+                test_object(bvh, bvh->refs[k].job, bvh->refs[k].obj, source, ray, hit);
+            continue;
+        }
+
+        // push the far child first so the near one is popped next
+        uint32_t left = node - bvh->nodes + 1, right = node->first;
+        if (neg[node->axis]) {
+            stack[top++] = left;
+            stack[top++] = right;
+        } else {
+            stack[top++] = right;
+            stack[top++] = left;
+        }
+    }
+
+    return hit->job != LUX_NO_HIT;
+}
+
+/* [occludes] whether object o of job j collides with a ray closer than max_t */
+static inline bool occludes(bvh_t *bvh, uint32_t j, uint32_t o, vec3 source, vec3 ray, real_t max_t)
+{
+    const job_t *job = &bvh->jobs[j];
+    collision_t col;
+    STATS_TEST(j, 1);
+    bool hit = intersect_object(job->kind, job, source, ray, job->data + o * job->obj_size, &col) && col.depth < max_t;
+    if (hit)
+        STATS_HIT(j);
+    return hit;
+}
+
+/* [occluded_job_as] first object of job j, of type kind, colliding with a ray closer than max_t, or obj_num */
+static inline __attribute__((always_inline))
+size_t occluded_job_as(bvh_t *bvh, uint32_t j, job_kind_t kind, vec3 source, vec3 ray, real_t max_t)
+{
+    const job_t *job = &bvh->jobs[j];
+    collision_t col;
+    size_t o;
+    for (o = 0; o < job->obj_num; o++) {
+        if (intersect_object(kind, job, source, ray, job->data + o * job->obj_size, &col) && col.depth < max_t)
+            break;
+    }
+    STATS_TEST(j, o < job->obj_num ? o + 1 : o);
+    if (o < job->obj_num)
+        STATS_HIT(j);
+    return o;
+}
+
+/* [occluded_job] occluded_job_as with one loop per primitive type */
+static size_t occluded_job(bvh_t *bvh, uint32_t j, vec3 source, vec3 ray, real_t max_t)
+{
+    switch (bvh->jobs[j].kind) {
+    case JOB_PLANE: return occluded_job_as(bvh, j, JOB_PLANE, source, ray, max_t);
+    case JOB_WALL: return occluded_job_as(bvh, j, JOB_WALL, source, ray, max_t);
+    case JOB_SPHERE: return occluded_job_as(bvh, j, JOB_SPHERE, source, ray, max_t);
+    case JOB_TRIANGLE: return occluded_job_as(bvh, j, JOB_TRIANGLE, source, ray, max_t);
+    default: return occluded_job_as(bvh, j, JOB_GENERIC, source, ray, max_t);
+    }
+}
+
+/*
+ * [bvh_occluded] whether any object collides with a ray before max_t
+ *   bvh: hierarchy
+ *   source: ray origin
+ *   ray: normalized ray direction
+ *   max_t: distance past which collisions are ignored
+ *   last: in: object to try first, or job LUX_NO_HIT; out: the occluder found, if any
+ *
+ * Stops at the first collision found, in no particular order.
+ */
+bool bvh_occluded(bvh_t *bvh, vec3 source, vec3 ray, real_t max_t, bvh_ref_t *last)
+{
+    if (last->job != LUX_NO_HIT && last->job < bvh->job_num && last->obj < bvh->jobs[last->job].obj_num
+            && occludes(bvh, last->job, last->obj, source, ray, max_t))
+        return true;
+
+    for (size_t u = 0; u < bvh->unbounded_num; u++) {
+        uint32_t j = bvh->unbounded[u];
+        size_t o = occluded_job(bvh, j, source, ray, max_t);
+        if (o < bvh->jobs[j].obj_num) {
+            *last = (bvh_ref_t) { .job = j, .obj = o };
+            return true;
+        }
+    }
+
+    if (bvh->node_num == 0)
+        return false;
+
+    vec3 inv = ray_inverse(ray);
+    uint32_t stack[BVH_STACK];
+    size_t top = 0;
+    stack[top++] = 0;
+
+    while (top > 0) {
+        bvh_node_t *node = &bvh->nodes[stack[--top]];
+        real_t tnear;
+        if (!ray_box(&node->box, source, inv, max_t, &tnear))
+            continue;
+
+        if (node->count > 0) {
+            if (node->spheres > 0) {
+                float t[KERNEL_LANES];
+                unsigned mask = sphere_intersect(&bvh->spheres, node->first, node->spheres, source, ray, t);
+                STATS(count_packed(bvh, node->first, node->spheres, mask, t, max_t));
+                for (size_t k = 0; mask; k++, mask >>= 1) {
+                    if ((mask & 1) && t[k] < max_t) {
+                        *last = bvh->refs[node->first + k];
+                        return true;
+                    }
+                }
+            }
+            if (node->triangles > 0) {
+                size_t first = node->first + node->spheres;
+                float t[KERNEL_LANES];
+                unsigned mask = triangle_intersect(&bvh->triangles, first, node->triangles, source, ray, t);
+                STATS(count_packed(bvh, first, node->triangles, mask, t, max_t));
+                for (size_t k = 0; mask; k++, mask >>= 1) {
+                    if ((mask & 1) && t[k] < max_t) {
+                        *last = bvh->refs[first + k];
+                        return true;
+                    }
+                }
+            }
+            for (size_t k = node->first + node->spheres + node->triangles; k < node->first + node->count; k++) {
+                if (occludes(bvh, bvh->refs[k].job, bvh->refs[k].obj, source, ray, max_t)) {
+                    *last = bvh->refs[k];
+                    return true;
+                }
+            }
+            continue;
+        }
+
+        stack[top++] = node->first;
+        stack[top++] = node - bvh->nodes + 1;
+    }
+
+    return false;
+}
+
+/* [packet_object] test rays [first, n) of a packet against one object */
+static inline void packet_object(bvh_t *bvh, packet_t *p, size_t first, uint32_t j, uint32_t o)
+{
+    const job_t *job = &bvh->jobs[j];
+    void *data = job->data + o * job->obj_size;
+
+    switch (job->kind) {
+    case JOB_SPHERE: {
+        sphere_t *s = (sphere_t*) data;
+        if (!packet_reject_sphere(p, s->pos, s->r))
+            packet_sphere(p, first, s->pos, s->r, s->color, j, o);
+        break;
+    }
+    case JOB_PLANE:
+        packet_plane(p, first, (plane_t*) data, j, o);
+        break;
+    case JOB_WALL:
+        packet_wall(p, first, (wall_t*) data, j, o);
+        break;
+    default:
+        packet_generic(p, first, job, j, o);
+        break;
+    }
+}
+
+/*
+ * [bvh_nearest_packet] find the nearest object along every ray of a packet
+ *   bvh: hierarchy
+ *   p: packet, with its frustum computed and every hit seeded like for bvh_nearest
+ *
+ * Subtrees are skipped when their box lies outside the packet frustum. Each
+ * stack entry carries the first ray that hits its parent, since rays before it
+ * cannot hit any of the children either.
+ */
+void bvh_nearest_packet(bvh_t *bvh, packet_t *p)
+{
+    for (size_t u = 0; u < bvh->unbounded_num; u++) {
+        uint32_t j = bvh->unbounded[u];
+        for (size_t o = 0; o < bvh->jobs[j].obj_num; o++)
+            packet_object(bvh, p, 0, j, o);
+    }
+
+    if (bvh->node_num == 0)
+        return;
+
+    vec3 inv[PACKET_MAX];
+    for (size_t k = 0; k < p->n; k++)
+        inv[k] = ray_inverse((vec3) { p->dx[k], p->dy[k], p->dz[k] });
+
+    struct { uint32_t node, first; } stack[BVH_STACK];
+    size_t top = 0;
+    stack[top].node = 0;
+    stack[top++].first = 0;
+
+    while (top > 0) {
+        top--;
+        bvh_node_t *node = &bvh->nodes[stack[top].node];
+        if (packet_reject_box(p, &node->box))
+            continue;
+
+        size_t first = stack[top].first;
+        for (; first < p->n; first++) {
+            real_t limit = p->hit[first].col.depth + 1e-6 * p->hit[first].col.depth;
+            real_t tnear;
+            if (ray_box(&node->box, p->origin, inv[first], limit, &tnear))
+                break;
+        }
+        if (first == p->n)
+            continue;
+
+        if (node->count > 0) {
+            for (size_t k = node->first; k < node->first + node->spheres; k++) {
+                vec3 pos = { bvh->spheres.x[k], bvh->spheres.y[k], bvh->spheres.z[k] };
+                vec3 color = { bvh->spheres.cr[k], bvh->spheres.cg[k], bvh->spheres.cb[k] };
+                if (!packet_reject_sphere(p, pos, bvh->spheres.r[k]))
+                    packet_sphere(p, first, pos, bvh->spheres.r[k], color, bvh->refs[k].job, bvh->refs[k].obj);
+            }
+            // triangles go ray by ray, each ray testing the whole leaf at once
+            if (node->triangles > 0) {
+                for (size_t r = first; r < p->n; r++) {
+                    vec3 ray = { p->dx[r], p->dy[r], p->dz[r] };
+                    nearest_triangles(bvh, node->first + node->spheres, node->triangles, p->origin, ray, &p->hit[r]);
+                }
+            }
+            for (size_t k = node->first + node->spheres + node->triangles; k < node->first + node->count; k++)
+                packet_object(bvh, p, first, bvh->refs[k].job, bvh->refs[k].obj);
+            continue;
+        }
+
+        // order children by the direction of the first ray that got here
+        uint32_t left = node - bvh->nodes + 1, right = node->first;
+        real_t d = node->axis == 0 ? p->dx[first] : (node->axis == 1 ? p->dy[first] : p->dz[first]);
+        stack[top].node = d < 0.0 ? left : right;
+        stack[top++].first = first;
+        stack[top].node = d < 0.0 ? right : left;
+        stack[top++].first = first;
+    }
+}
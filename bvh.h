@@ -0,0 +1,53 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "lux.h"
+#include "kernels.h"
+#include "packet.h"
+
+/* reference to object obj of job job */
+typedef struct {
+    uint32_t job;
+    uint32_t obj;
+} bvh_ref_t;
+
+typedef struct {
+    aabb_t box;
+    /* leaf: index of the first ref; inner node: index of the right child (left is this + 1) */
+    uint32_t first;
+    /* number of refs in a leaf (at most BVH_LEAF_MAX), 0 for inner nodes */
+    uint8_t count;
+    /* split axis of an inner node */
+    uint8_t axis;
+    /* number of leading refs of a leaf that are spheres, tested with sphere_intersect */
+    uint8_t spheres;
+    /* number of triangles right after the spheres, tested with triangle_intersect */
+    uint8_t triangles;
+} bvh_node_t;
+
+typedef struct bvh {
+    /* unique among all hierarchies built by this process */
+    uint64_t id;
+    /* copy of all submitted jobs, in submission order, cache-aligned */
+    job_t *jobs;
+    size_t job_num;
+    /* indices of jobs without bounds, tested linearly */
+    uint32_t *unbounded;
+    size_t unbounded_num;
+    bvh_node_t *nodes;
+    size_t node_num;
+    bvh_ref_t *refs;
+    size_t ref_num;
+    /* copy of every sphere, indexed like refs (other slots are unused) */
+    sphere_soa_t spheres;
+    /* same for triangles, only allocated if there are any */
+    triangle_soa_t triangles;
+} bvh_t;
+
+bvh_t *bvh_build(const job_t *jobs, size_t job_num);
+void bvh_free(bvh_t *bvh);
+bool bvh_nearest(bvh_t *bvh, vec3 source, vec3 ray, hit_t *hit);
+bool bvh_occluded(bvh_t *bvh, vec3 source, vec3 ray, real_t max_t, bvh_ref_t *last);
+void bvh_nearest_packet(bvh_t *bvh, packet_t *p);
+
+#endif
@@ -1,4 +1,5 @@
 #include "camera.h"
+#include <stdlib.h>
 #include <math.h>
 
 void set_vertical_up(camera_t *cam)
@@ -11,13 +12,14 @@ void set_vertical_up(camera_t *cam)
     }
 }
 
-camera_t camera_build(vec3 watch, vec3 pos, double fov)
+camera_t camera_build(vec3 watch, vec3 pos, real_t fov)
 {
     camera_t cam;
     vec3_normalize(watch, &cam.v);
     set_vertical_up(&cam);
     cam.p = pos;
     cam.fov = fov;
+    camera_invalidate(&cam);
     
     return cam;
 }
@@ -28,12 +30,26 @@ void camera_look_at(vec3 pos, camera_t *cam)
     vec3_sub(cam->v, cam->p, &cam->v);
     vec3_normalize(cam->v, &cam->v);
     set_vertical_up(cam);
+    camera_invalidate(cam);
 }
 
-vec3 camera_pixel_to_ray(camera_t *camera, double i, double j, double aspect_ratio)
+/*
+ * [camera_invalidate] mark frames set up for this camera as stale
+ *   cam: camera whose fields were changed
+ *
+ * camera_build and camera_look_at call this; code assigning camera fields
+ * directly must call it too.
+ */
+void camera_invalidate(camera_t *cam)
 {
-    double h = 2 * tan(camera->fov * (M_PI / 180.0));
-    double w = aspect_ratio * h;
+    static uint64_t versions = 0;
+    cam->version = __atomic_add_fetch(&versions, 1, __ATOMIC_RELAXED);
+}
+
+vec3 camera_pixel_to_ray(camera_t *camera, real_t i, real_t j, real_t aspect_ratio)
+{
+    real_t h = 2 * tan(camera->fov * (M_PI / 180.0));
+    real_t w = aspect_ratio * h;
 
     vec3 center, l, ray, au, bl;
     vec3_add(camera->p, camera->v, &center);
@@ -52,4 +68,73 @@ vec3 camera_pixel_to_ray(camera_t *camera, double i, double j, double aspect_rat
     return ray;
 }
 
+/*
+ * [camera_frame_setup] precompute ray generation for a frame, if not done already
+ *   frame: frame state, zero-initialized before the first call
+ *   cam: camera
+ *   width, height: image dimensions in pixels
+ */
+int camera_frame_setup(camera_frame_t *frame, camera_t *cam, size_t width, size_t height)
+{
+    if (frame->row && frame->version == cam->version && frame->width == width && frame->height == height)
+        return 0;
+
+    if (frame->width != width || frame->height != height || !frame->row) {
+        camera_frame_free(frame);
+        frame->row = malloc(sizeof(vec3) * height);
+        frame->col = malloc(sizeof(vec3) * width);
+        if (!frame->row || !frame->col) {
+            camera_frame_free(frame);
+            return -1;
+        }
+        frame->width = width;
+        frame->height = height;
+    }
+
+    real_t aspect_ratio = ((real_t) width) / height;
+    real_t h = 2 * tan(cam->fov * (M_PI / 180.0));
+    real_t w = aspect_ratio * h;
+
+    vec3 l;
+    vec3_add(cam->p, cam->v, &frame->center);
+    vec3_cross(cam->v, cam->u, &l);
+    frame->p = cam->p;
+
+    for (size_t j = 0; j < height; j++)
+        vec3_mul(cam->u, (h / 2) * (1 - 2 * ((real_t) j / (real_t) height)), &frame->row[j]);
+    for (size_t i = 0; i < width; i++)
+        vec3_mul(l, (w / 2) * (1 - 2 * ((real_t) i / (real_t) width)), &frame->col[i]);
+
+    frame->version = cam->version;
+    return 0;
+}
+
+void camera_frame_free(camera_frame_t *frame)
+{
+    free(frame->row);
+    free(frame->col);
+    frame->row = NULL;
+    frame->col = NULL;
+    frame->width = frame->height = 0;
+}
 
+/*
+ * [camera_frame_row] rays through pixels [i0, i0 + n) of row j
+ *   frame: frame state
+ *   j: row
+ *   i0, n: range of columns
+ *   rays: where to write the n rays
+ */
+void camera_frame_row(const camera_frame_t *frame, size_t j, size_t i0, size_t n, vec3 *rays)
+{
+    vec3 base = { 0.0, 0.0, 0.0 };
+    vec3_add(base, frame->center, &base);
+    vec3_add(base, frame->row[j], &base);
+
+    for (size_t k = 0; k < n; k++) {
+        vec3 world;
+        vec3_add(base, frame->col[i0 + k], &world);
+        vec3_sub(world, frame->p, &world);
+        vec3_normalize(world, &rays[k]);
+    }
+}
@@ -1,6 +1,8 @@
 #ifndef CAMERA_H
 #define CAMERA_H
 
+#include <stddef.h>
+#include <stdint.h>
 #include "vec3.h" 
 
 typedef struct {
@@ -11,11 +13,45 @@ typedef struct {
     /* camera position */
     vec3 p;
     /* horizontal fov in degrees */
-    double fov;
+    real_t fov;
+    /* changes whenever the camera is rebuilt, see camera_invalidate */
+    uint64_t version;
 } camera_t;
 
-camera_t camera_build(vec3 watch, vec3 pos, double fov);
+/*
+ * Per-frame ray generation state: the camera basis and the per-row and
+ * per-column offsets on the image plane, computed once by camera_frame_setup.
+ * The direction through pixel (i, j) is then center + row[j] + col[i] - p,
+ * normalized, which is the exact arithmetic of camera_pixel_to_ray.
+ */
+typedef struct {
+    size_t width, height;
+    /* version of the camera the offsets were computed for */
+    uint64_t version;
+    vec3 p;
+    vec3 center;
+    vec3 *row, *col;
+} camera_frame_t;
+
+camera_t camera_build(vec3 watch, vec3 pos, real_t fov);
 void camera_look_at(vec3 pos, camera_t *cam);
-vec3 camera_pixel_to_ray(camera_t *camera, double i, double j, double aspect_ratio);
+void camera_invalidate(camera_t *cam);
+vec3 camera_pixel_to_ray(camera_t *camera, real_t i, real_t j, real_t aspect_ratio);
+
+int camera_frame_setup(camera_frame_t *frame, camera_t *cam, size_t width, size_t height);
+void camera_frame_free(camera_frame_t *frame);
+void camera_frame_row(const camera_frame_t *frame, size_t j, size_t i0, size_t n, vec3 *rays);
+
+/* [camera_frame_ray] ray through pixel (i, j), same result as camera_pixel_to_ray */
+static inline vec3 camera_frame_ray(const camera_frame_t *frame, size_t i, size_t j)
+{
+    vec3 world = { 0.0, 0.0, 0.0 };
+    vec3_add(world, frame->center, &world);
+    vec3_add(world, frame->row[j], &world);
+    vec3_add(world, frame->col[i], &world);
+    vec3_sub(world, frame->p, &world);
+    vec3_normalize(world, &world);
+    return world;
+}
 
 #endif
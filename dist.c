@@ -0,0 +1,329 @@
+#include "dist.h"
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include "sched.h"
+#include "shadowmap.h"
+#include "sock.h"
+
+/*
+ * Coordinator/worker rendering on one machine. The coordinator forks worker
+ * processes once the scene is committed, so each of them starts with the
+ * scene, its hierarchy and its shadow maps already in memory, and talks to
+ * each one over a Unix socket pair:
+ *
+ *   coordinator -> worker: tile_t to render
+ *   worker -> coordinator: dist_reply_t, then the 3 * w * h bytes of the
+ *                          tile's pixels and its w * h depths, row by row
+ *
+ * Both ends run the same binary, so structures go over the wire as they are.
+ * Workers pull: each has at most DIST_INFLIGHT tiles queued and gets the next
+ * one as soon as it returns one, so faster workers end up rendering more
+ * tiles. The tiles of a worker that dies are handed to the others; if all of
+ * them are gone the coordinator renders what is left itself.
+ */
+
+typedef struct {
+    tile_t tile;
+    uint64_t primary_rays, shadow_rays;
+} dist_reply_t;
+
+typedef struct {
+    pid_t pid;
+    /* coordinator end of the socket pair, -1 once the worker is lost */
+    int fd;
+    /* tiles sent and not returned yet, in the order the worker renders them */
+    size_t queue[DIST_INFLIGHT];
+    size_t queued;
+} dist_worker_t;
+
+/* tiles of rows [y0, y1) and what became of each of them */
+typedef struct {
+    size_t y0, y1;
+    size_t tile_size, tiles_x, tiles_y;
+    /* TILE_PENDING, TILE_SENT or TILE_DONE per tile */
+    uint8_t *state;
+    /* no pending tile before this one */
+    size_t next;
+    size_t done;
+} dist_window_t;
+
+enum { TILE_PENDING, TILE_SENT, TILE_DONE };
+
+static tile_t window_tile(const dist_window_t *win, size_t width, size_t t)
+{
+    size_t ts = win->tile_size;
+    tile_t tile = {
+        .x0 = t % win->tiles_x * ts, .y0 = win->y0 + t / win->tiles_x * ts,
+        .x1 = (t % win->tiles_x + 1) * ts, .y1 = win->y0 + (t / win->tiles_x + 1) * ts,
+    };
+    if (tile.x1 > width) tile.x1 = width;
+    if (tile.y1 > win->y1) tile.y1 = win->y1;
+    return tile;
+}
+
+/*
+ * [worker_main] render the tiles the coordinator sends until it hangs up
+ *   lux: scene as committed by the coordinator
+ *   fd: worker end of the socket pair
+ */
+static void worker_main(lux_t *lux, int fd)
+{
+    size_t width = lux->ppm->width;
+    size_t ts = lux->tile_size ? lux->tile_size : LUX_TILE_SIZE;
+
+    // a window of one tile row, moved onto each tile, with depths of its own:
+    // those of the coordinator's first window as it was at the fork, FLT_MAX below
+    lux_t w = *lux;
+    w.ppm = ppm_open(NULL, width, lux->ppm->height, PPM_STREAM, ts);
+    w.depth = malloc(sizeof(float) * width * ts);
+    w.frame = (camera_frame_t) { 0 };
+    w.gbuffer = (gbuffer_t) { 0 };
+    w.stats = NULL;
+    uint8_t *buf = malloc(sizeof(dist_reply_t) + (3 + sizeof(float)) * ts * ts);
+    if (!w.ppm || !w.depth || !buf)
+        _exit(1);
+
+    tile_t tile;
+    while (sock_read_full(fd, &tile, sizeof(tile_t)) == 0) {
+        size_t tw = tile.x1 - tile.x0, th = tile.y1 - tile.y0;
+        w.ppm->row0 = tile.y0;
+        memset(w.ppm->data, 0, 3 * width * th);
+        for (size_t j = tile.y0; j < tile.y1; j++) {
+            bool first = j < lux->ppm->row0 + lux->ppm->rows;
+            for (size_t i = tile.x0; i < tile.x1; i++)
+                *lux_depth_at(&w, i, j) = first ? *lux_depth_at(lux, i, j) : FLT_MAX;
+        }
+        w.primary_rays = w.shadow_rays = 0;
+        if (lux_render_tile(&w, tile) != 0)
+            break;
+
+        dist_reply_t *reply = (dist_reply_t*) buf;
+        *reply = (dist_reply_t) { .tile = tile, .primary_rays = w.primary_rays, .shadow_rays = w.shadow_rays };
+        uint8_t *px = buf + sizeof(dist_reply_t);
+        float *depth = (float*) (px + 3 * tw * th);
+        for (size_t j = 0; j < th; j++) {
+            memcpy(&px[3 * j * tw], &w.ppm->data[3 * (j * width + tile.x0)], 3 * tw);
+            memcpy(&depth[j * tw], lux_depth_at(&w, tile.x0, tile.y0 + j), sizeof(float) * tw);
+        }
+        if (sock_write_full(fd, buf, sizeof(dist_reply_t) + (3 + sizeof(float)) * tw * th) != 0)
+            break;
+    }
+
+    // skip exit handlers and stdio buffers: they belong to the coordinator
+    _exit(0);
+}
+
+/* [worker_lost] give the tiles of a dead or misbehaving worker back to the queue */
+static void worker_lost(dist_worker_t *worker, dist_window_t *win)
+{
+    for (size_t q = 0; q < worker->queued; q++) {
+        win->state[worker->queue[q]] = TILE_PENDING;
+        if (worker->queue[q] < win->next)
+            win->next = worker->queue[q];
+    }
+    worker->queued = 0;
+
+    kill(worker->pid, SIGKILL);
+    close(worker->fd);
+    waitpid(worker->pid, NULL, 0);
+    worker->fd = -1;
+}
+
+/* [worker_feed] top up the queue of a worker, false if it is lost */
+static bool worker_feed(lux_t *lux, dist_worker_t *worker, dist_window_t *win)
+{
+    size_t n = win->tiles_x * win->tiles_y;
+    while (worker->queued < DIST_INFLIGHT) {
+        while (win->next < n && win->state[win->next] != TILE_PENDING)
+            win->next++;
+        if (win->next == n)
+            break;
+
+        tile_t tile = window_tile(win, lux->ppm->width, win->next);
+        if (sock_write_full(worker->fd, &tile, sizeof(tile_t)) != 0) {
+            worker_lost(worker, win);
+            return false;
+        }
+        win->state[win->next] = TILE_SENT;
+        worker->queue[worker->queued++] = win->next;
+    }
+    return true;
+}
+
+/* [worker_collect] store the next tile a worker returns, false if it is lost */
+static bool worker_collect(lux_t *lux, dist_worker_t *worker, dist_window_t *win, uint8_t *buf)
+{
+    size_t width = lux->ppm->width;
+    if (worker->queued == 0) {
+        worker_lost(worker, win);
+        return false;
+    }
+    tile_t expect = window_tile(win, width, worker->queue[0]);
+    size_t tw = expect.x1 - expect.x0, th = expect.y1 - expect.y0;
+
+    dist_reply_t reply;
+    if (sock_read_full(worker->fd, &reply, sizeof(dist_reply_t)) != 0
+        || memcmp(&reply.tile, &expect, sizeof(tile_t)) != 0
+        || sock_read_full(worker->fd, buf, (3 + sizeof(float)) * tw * th) != 0) {
+        worker_lost(worker, win);
+        return false;
+    }
+
+    const float *depth = (const float*) (buf + 3 * tw * th);
+    for (size_t j = 0; j < th; j++) {
+        size_t y = expect.y0 + j;
+        memcpy(&lux->ppm->data[3 * ((y - lux->ppm->row0) * width + expect.x0)], &buf[3 * j * tw], 3 * tw);
+        memcpy(lux_depth_at(lux, expect.x0, y), &depth[j * tw], sizeof(float) * tw);
+    }
+    lux->primary_rays += reply.primary_rays;
+    lux->shadow_rays += reply.shadow_rays;
+
+    win->state[worker->queue[0]] = TILE_DONE;
+    win->done++;
+    memmove(&worker->queue[0], &worker->queue[1], sizeof(size_t) * --worker->queued);
+    return true;
+}
+
+/* [render_window] have the workers render the tiles of a window into the coordinator's image */
+static int render_window(lux_t *lux, dist_worker_t *workers, size_t nworkers, dist_window_t *win, uint8_t *buf)
+{
+    size_t n = win->tiles_x * win->tiles_y;
+    struct pollfd *fds = malloc(sizeof(struct pollfd) * nworkers);
+    size_t *who = malloc(sizeof(size_t) * nworkers);
+    if (!fds || !who) {
+        free(fds);
+        free(who);
+        return -1;
+    }
+
+    int err = 0;
+    while (win->done < n) {
+        size_t alive = 0;
+        for (size_t k = 0; k < nworkers; k++) {
+            if (workers[k].fd >= 0 && worker_feed(lux, &workers[k], win) && workers[k].queued > 0) {
+                fds[alive] = (struct pollfd) { .fd = workers[k].fd, .events = POLLIN };
+                who[alive++] = k;
+            }
+        }
+
+        // every worker is gone: finish here
+        if (alive == 0) {
+            for (size_t t = 0; t < n && !err; t++) {
+                if (win->state[t] == TILE_DONE)
+                    continue;
+                err = lux_render_tile(lux, window_tile(win, lux->ppm->width, t));
+                win->state[t] = TILE_DONE;
+                win->done++;
+            }
+            break;
+        }
+
+        if (poll(fds, alive, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            err = -1;
+            break;
+        }
+        for (size_t a = 0; a < alive; a++) {
+            if (fds[a].revents)
+                worker_collect(lux, &workers[who[a]], win, buf);
+        }
+    }
+
+    free(fds);
+    free(who);
+    return err;
+}
+
+/*
+ * [lux_render_distributed] render a frame with worker processes
+ *   lux: lux context, like for lux_render; the depth buffer must be initialized
+ *   workers: number of worker processes, 0 picks one per core
+ *
+ * Same image as lux_render. Adaptive anti-aliasing is refused: it needs the
+ * neighbours of a pixel, which may belong to another worker.
+ */
+int lux_render_distributed(lux_t *lux, size_t workers)
+{
+    if (lux->aa_samples > 0 && lux->path_samples == 0)
+        return -1;
+    if ((lux->dirty || !lux->bvh) && lux_commit(lux) != 0)
+        return -1;
+    if (workers == 0)
+        workers = sched_default_threads();
+
+    ppm_t *ppm = lux->ppm;
+    size_t ts = lux->tile_size ? lux->tile_size : LUX_TILE_SIZE;
+    lux->primary_rays = lux->shadow_rays = 0;
+    if (lux->shadow_map && shadow_maps_update(lux, lux->threads ? lux->threads : sched_default_threads()) != 0)
+        return -1;
+
+    dist_worker_t *w = calloc(workers, sizeof(dist_worker_t));
+    uint8_t *buf = malloc((3 + sizeof(float)) * ts * ts);
+    if (!w || !buf) {
+        free(w);
+        free(buf);
+        return -1;
+    }
+
+    size_t spawned;
+    for (spawned = 0; spawned < workers; spawned++) {
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0)
+            break;
+        pid_t pid = fork();
+        if (pid < 0) {
+            close(sv[0]);
+            close(sv[1]);
+            break;
+        }
+        if (pid == 0) {
+            // a worker holding another worker's socket would keep it open after the coordinator hangs up
+            for (size_t k = 0; k < spawned; k++)
+                close(w[k].fd);
+            close(sv[0]);
+            worker_main(lux, sv[1]);
+        }
+        close(sv[1]);
+        w[spawned] = (dist_worker_t) { .pid = pid, .fd = sv[0] };
+    }
+
+    // streamed images only hold a window of rows: render it, write it out, move on
+    int err = 0;
+    for (;;) {
+        size_t y1 = ppm->row0 + ppm->rows < ppm->height ? ppm->row0 + ppm->rows : ppm->height;
+        dist_window_t win = {
+            .y0 = ppm->row0, .y1 = y1,
+            .tile_size = ts,
+            .tiles_x = (ppm->width + ts - 1) / ts,
+            .tiles_y = (y1 - ppm->row0 + ts - 1) / ts,
+        };
+        if (!(win.state = calloc(win.tiles_x * win.tiles_y, 1))) {
+            err = -1;
+            break;
+        }
+        err = render_window(lux, w, spawned, &win, buf);
+        free(win.state);
+
+        if (err || !(ppm->flags & PPM_STREAM) || (err = lux_flush_window(lux)) != 0 || ppm->row0 >= ppm->height)
+            break;
+    }
+
+    // hanging up tells the workers to exit
+    for (size_t k = 0; k < spawned; k++) {
+        if (w[k].fd < 0)
+            continue;
+        close(w[k].fd);
+        waitpid(w[k].pid, NULL, 0);
+    }
+    free(w);
+    free(buf);
+    return err;
+}
@@ -0,0 +1,11 @@
+#ifndef DIST_H
+#define DIST_H
+
+#include "lux.h"
+
+/* tiles handed to a worker ahead of the one it renders, so it never waits for the next */
+#define DIST_INFLIGHT 2
+
+int lux_render_distributed(lux_t *lux, size_t workers);
+
+#endif
@@ -0,0 +1,29 @@
+#include "gbuffer.h"
+#include <stdlib.h>
+
+/*
+ * [gbuffer_setup] make a G-buffer hold a window of rows, reusing its memory when it fits
+ *   g: G-buffer, zero-initialized before the first call
+ *   width: image width
+ *   height: rows in the window
+ *   row0: first image row of the window
+ */
+int gbuffer_setup(gbuffer_t *g, size_t width, size_t height, size_t row0)
+{
+    if (!g->px || g->width * g->height < width * height) {
+        free(g->px);
+        g->px = malloc(sizeof(gsample_t) * width * height);
+        if (!g->px)
+            return -1;
+    }
+    g->width = width;
+    g->height = height;
+    g->row0 = row0;
+    return 0;
+}
+
+void gbuffer_free(gbuffer_t *g)
+{
+    free(g->px);
+    g->px = NULL;
+}
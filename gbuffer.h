@@ -0,0 +1,41 @@
+#ifndef GBUFFER_H
+#define GBUFFER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "vec3.h"
+
+/* what the visibility pass found behind a pixel */
+typedef struct {
+    /* hit point in world space */
+    vec3 point;
+    /* unit surface normal, facing the camera */
+    vec3 normal;
+    vec3 color;
+    float depth;
+    /* object id: job and object index, job is LUX_NO_HIT where nothing was hit */
+    uint32_t job, obj;
+    /* marked by the edge detection of adaptive anti-aliasing */
+    bool edge;
+} gsample_t;
+
+/*
+ * Visibility of a window of image rows [row0, row0 + height), filled by the
+ * visibility pass and read by the shading pass and any later pass.
+ */
+typedef struct {
+    size_t width, height;
+    size_t row0;
+    gsample_t *px;
+} gbuffer_t;
+
+int gbuffer_setup(gbuffer_t *g, size_t width, size_t height, size_t row0);
+void gbuffer_free(gbuffer_t *g);
+
+/* [gbuffer_at] sample of image pixel (i, j), j within the window */
+static inline gsample_t *gbuffer_at(const gbuffer_t *g, size_t i, size_t j)
+{
+    return &g->px[(j - g->row0) * g->width + i];
+}
+
+#endif
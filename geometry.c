@@ -0,0 +1,94 @@
+#include "geometry.h"
+#include <math.h>
+
+bool test_ray_plane(vec3 camera, vec3 ray, void *obj, collision_t *col)
+{
+    return intersect_plane(camera, ray, (plane_t*) obj, col);
+}
+
+void normal_plane(void *obj, vec3 point, vec3 *n)
+{
+    (void) point;
+    plane_normal((plane_t*) obj, n);
+}
+
+bool test_ray_wall(vec3 camera, vec3 ray, void *obj, collision_t *col)
+{
+    return intersect_wall(camera, ray, (wall_t*) obj, col);
+}
+
+void bound_wall(void *obj, aabb_t *box)
+{
+    wall_t *wall = (wall_t*) obj;
+
+    // the wall spans width / |u| along u and width / |v| along v
+    real_t su = wall->width / vec3_dot(wall->u, wall->u);
+    real_t sv = wall->width / vec3_dot(wall->v, wall->v);
+    vec3 ext = {
+        su * real_abs(wall->u.x) + sv * real_abs(wall->v.x),
+        su * real_abs(wall->u.y) + sv * real_abs(wall->v.y),
+        su * real_abs(wall->u.z) + sv * real_abs(wall->v.z),
+    };
+    vec3_sub(wall->p, ext, &box->min);
+    vec3_add(wall->p, ext, &box->max);
+}
+
+void normal_wall(void *obj, vec3 point, vec3 *n)
+{
+    (void) point;
+    wall_normal((wall_t*) obj, n);
+}
+
+bool test_ray_sphere(vec3 camera, vec3 ray, void *obj, collision_t *col)
+{
+    return intersect_sphere(camera, ray, (sphere_t*) obj, col);
+}
+
+void bound_sphere(void *obj, aabb_t *box)
+{
+    sphere_t *s = (sphere_t*) obj;
+    vec3 ext = { s->r, s->r, s->r };
+    vec3_sub(s->pos, ext, &box->min);
+    vec3_add(s->pos, ext, &box->max);
+}
+
+void normal_sphere(void *obj, vec3 point, vec3 *n)
+{
+    sphere_normal((sphere_t*) obj, point, n);
+}
+
+bool test_ray_triangle(vec3 camera, vec3 ray, void *obj, collision_t *col)
+{
+    return intersect_triangle(camera, ray, (triangle_t*) obj, col);
+}
+
+void bound_triangle(void *obj, aabb_t *box)
+{
+    triangle_t *tri = (triangle_t*) obj;
+    const vec3 *v = tri->mesh->vertices;
+    box->min = box->max = v[tri->v[0]];
+    for (int k = 1; k < 3; k++) {
+        vec3 p = v[tri->v[k]];
+        box->min = (vec3) { real_min(box->min.x, p.x), real_min(box->min.y, p.y), real_min(box->min.z, p.z) };
+        box->max = (vec3) { real_max(box->max.x, p.x), real_max(box->max.y, p.y), real_max(box->max.z, p.z) };
+    }
+}
+
+void normal_triangle(void *obj, vec3 point, vec3 *n)
+{
+    (void) point;
+    triangle_normal((triangle_t*) obj, n);
+}
+
+/*
+ * [geometry_kind] built-in primitive type of a job's test and normal
+ * functions, JOB_GENERIC unless both are the built-in ones of a type
+ */
+job_kind_t geometry_kind(collide *test, normal_at *normal)
+{
+    if (test == &test_ray_plane && normal == &normal_plane) return JOB_PLANE;
+    if (test == &test_ray_wall && normal == &normal_wall) return JOB_WALL;
+    if (test == &test_ray_sphere && normal == &normal_sphere) return JOB_SPHERE;
+    if (test == &test_ray_triangle && normal == &normal_triangle) return JOB_TRIANGLE;
+    return JOB_GENERIC;
+}
@@ -0,0 +1,232 @@
+#ifndef GEOMETRY_H
+#define GEOMETRY_H
+
+#include "lux.h"
+
+typedef struct {
+    vec3 color;
+    vec3 u, v; // orientation
+    vec3 p; // any point on the plane
+} plane_t;
+
+typedef struct {
+    vec3 color;
+    vec3 u, v;
+    vec3 p;
+    real_t width;
+} wall_t;
+
+typedef struct {
+    vec3 color;
+    real_t r;
+    vec3 pos;
+} sphere_t;
+
+struct mesh;
+
+/* one triangle of a mesh: indices of its corners in the mesh's vertex buffer */
+typedef struct {
+    const struct mesh *mesh;
+    uint32_t v[3];
+} triangle_t;
+
+/*
+ * Triangle mesh: a shared vertex buffer and one triangle_t per face; the
+ * triangles array is the job's object array.
+ */
+typedef struct mesh {
+    vec3 color;
+    vec3 *vertices;
+    size_t vertex_num;
+    triangle_t *triangles;
+    size_t triangle_num;
+} mesh_t;
+
+/*
+ * The ray tests and normals of the built-in primitives are defined here so
+ * the per-type loops of the traversal and of wavefront shading inline them;
+ * test_ray_* and normal_* wrap them for job_t and identify the type of a job
+ * (geometry_kind).
+ */
+
+static inline bool intersect_plane(vec3 camera, vec3 ray, const plane_t *plane, collision_t *col)
+{
+    vec3 m;
+    vec3_sub(camera, plane->p, &m);
+    vec3 n;
+    vec3_cross(plane->u, plane->v, &n);
+
+    real_t nm = vec3_dot(n, m);
+    real_t nray = vec3_dot(n, ray);
+
+    if (nm * nray < 0.0) {
+        col->depth = - nm / nray;
+        col->color = plane->color;
+        return true;
+    }
+
+    return false;
+}
+
+static inline bool intersect_wall(vec3 camera, vec3 ray, const wall_t *wall, collision_t *col)
+{
+    vec3 m;
+    vec3_sub(camera, wall->p, &m);
+    vec3 n;
+    vec3_cross(wall->u, wall->v, &n);
+
+    real_t nm = vec3_dot(n, m);
+    real_t nray = vec3_dot(n, ray);
+
+    if (nm * nray < 0.0) {
+        col->depth = - nm / nray;
+        col->color = wall->color;
+
+        vec3 pt = ray;
+        vec3_mul(pt, col->depth, &pt);
+        vec3_add(pt, camera, &pt);
+        vec3_sub(pt, wall->p, &pt);
+
+        if (real_abs(vec3_dot(pt, wall->u)) < wall->width && real_abs(vec3_dot(pt, wall->v)) < wall->width)
+            return true;
+    }
+
+    return false;
+}
+
+static inline bool intersect_sphere(vec3 camera, vec3 ray, const sphere_t *s, collision_t *col)
+{
+    vec3 m;
+    vec3_sub(camera, s->pos, &m);
+
+    real_t b = vec3_dot(m, ray);
+    real_t c = vec3_dot(m, m) - s->r*s->r;
+
+    // Check if interscetion
+    if (c > 0.0 && b > 0.0) return false;
+
+    float discr = b*b - c;
+    if (discr < 0.0) return false;
+
+    // Calculate intersection
+    float t = -b - real_sqrt(discr);
+    if (t < 0.0) t = 0.0;
+
+    col->color = s->color;
+    col->depth = t;
+
+    return true;
+}
+
+/*
+ * [intersect_triangle] Moller-Trumbore ray/triangle test
+ *
+ * Conditions are written so that NaNs (degenerate triangles) count as misses.
+ * triangle_intersect in kernels.c repeats this arithmetic exactly.
+ */
+static inline bool intersect_triangle(vec3 camera, vec3 ray, const triangle_t *tri, collision_t *col)
+{
+    const vec3 *v = tri->mesh->vertices;
+    vec3 a = v[tri->v[0]];
+
+    vec3 e1, e2;
+    vec3_sub(v[tri->v[1]], a, &e1);
+    vec3_sub(v[tri->v[2]], a, &e2);
+
+    vec3 p;
+    vec3_cross(ray, e2, &p);
+    real_t det = vec3_dot(e1, p);
+    if (det == 0.0) return false;
+    real_t inv = 1 / det;
+
+    vec3 s;
+    vec3_sub(camera, a, &s);
+    real_t u = vec3_dot(s, p) * inv;
+    if (!(u >= 0.0 && u <= 1.0)) return false;
+
+    vec3 q;
+    vec3_cross(s, e1, &q);
+    real_t w = vec3_dot(ray, q) * inv;
+    if (!(w >= 0.0 && u + w <= 1.0)) return false;
+
+    real_t t = vec3_dot(e2, q) * inv;
+    if (!(t > 0.0)) return false;
+
+    col->depth = t;
+    col->color = tri->mesh->color;
+    return true;
+}
+
+/*
+ * [intersect_object] test a ray against object obj of a job of type kind
+ *
+ * Always inlined: called with a constant kind, the switch folds away and
+ * built-in primitives are tested without any indirect call.
+ */
+static inline __attribute__((always_inline))
+bool intersect_object(job_kind_t kind, const job_t *job, vec3 source, vec3 ray, void *obj, collision_t *col)
+{
+    switch (kind) {
+    case JOB_PLANE: return intersect_plane(source, ray, obj, col);
+    case JOB_WALL: return intersect_wall(source, ray, obj, col);
+    case JOB_SPHERE: return intersect_sphere(source, ray, obj, col);
+    case JOB_TRIANGLE: return intersect_triangle(source, ray, obj, col);
+    default: return job->test(source, ray, obj, col);
+    }
+}
+
+static inline void plane_normal(const plane_t *plane, vec3 *n)
+{
+    vec3_cross(plane->u, plane->v, n);
+    vec3_normalize(*n, n);
+}
+
+static inline void wall_normal(const wall_t *wall, vec3 *n)
+{
+    vec3_cross(wall->u, wall->v, n);
+    vec3_normalize(*n, n);
+}
+
+static inline void sphere_normal(const sphere_t *s, vec3 point, vec3 *n)
+{
+    vec3_sub(point, s->pos, n);
+    vec3_normalize(*n, n);
+}
+
+static inline void triangle_normal(const triangle_t *tri, vec3 *n)
+{
+    const vec3 *v = tri->mesh->vertices;
+    vec3 e1, e2;
+    vec3_sub(v[tri->v[1]], v[tri->v[0]], &e1);
+    vec3_sub(v[tri->v[2]], v[tri->v[0]], &e2);
+    vec3_cross(e1, e2, n);
+    vec3_normalize(*n, n);
+}
+
+/* [normal_object] unit normal of object obj of a job of type kind at point, like intersect_object */
+static inline __attribute__((always_inline))
+void normal_object(job_kind_t kind, const job_t *job, void *obj, vec3 point, vec3 *n)
+{
+    switch (kind) {
+    case JOB_PLANE: plane_normal(obj, n); break;
+    case JOB_WALL: wall_normal(obj, n); break;
+    case JOB_SPHERE: sphere_normal(obj, point, n); break;
+    case JOB_TRIANGLE: triangle_normal(obj, n); break;
+    default: job->normal(obj, point, n); break;
+    }
+}
+
+job_kind_t geometry_kind(collide *test, normal_at *normal);
+bool test_ray_plane(vec3 camera, vec3 ray, void *obj, collision_t *col);
+bool test_ray_wall(vec3 camera, vec3 ray, void *obj, collision_t *col);
+bool test_ray_sphere(vec3 camera, vec3 ray, void *obj, collision_t *col);
+bool test_ray_triangle(vec3 camera, vec3 ray, void *obj, collision_t *col);
+void bound_wall(void *obj, aabb_t *box);
+void bound_sphere(void *obj, aabb_t *box);
+void bound_triangle(void *obj, aabb_t *box);
+void normal_plane(void *obj, vec3 point, vec3 *n);
+void normal_wall(void *obj, vec3 point, vec3 *n);
+void normal_sphere(void *obj, vec3 point, vec3 *n);
+void normal_triangle(void *obj, vec3 point, vec3 *n);
+
+#endif
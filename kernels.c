@@ -0,0 +1,549 @@
+#include "kernels.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KERNELS_X86
+#endif
+
+/*
+ * Packed intersection kernels. Each kernel tests one ray against several
+ * objects at once and reproduces the arithmetic of the scalar test functions in
+ * geometry.c exactly (same operation order, same float roundings), so picking a
+ * kernel never changes the image. The widest kernel the CPU supports is picked
+ * at runtime by kernels_init; LUX_SIMD=scalar|sse2|avx2 overrides the choice.
+ */
+
+////////////////////////////////////
+// STORAGE
+////////////////////////////////////
+
+static real_t *soa_array(size_t num)
+{
+    size_t bytes = sizeof(real_t) * ((num + 2 * KERNEL_LANES - 1) / KERNEL_LANES * KERNEL_LANES);
+    bytes = (bytes + 31) & ~(size_t) 31;
+    real_t *a = aligned_alloc(32, bytes);
+    if (a)
+        memset(a, 0, bytes);
+    return a;
+}
+
+int sphere_soa_init(sphere_soa_t *soa, size_t num)
+{
+    soa->num = num;
+    soa->x = soa_array(num);
+    soa->y = soa_array(num);
+    soa->z = soa_array(num);
+    soa->r = soa_array(num);
+    soa->cr = soa_array(num);
+    soa->cg = soa_array(num);
+    soa->cb = soa_array(num);
+
+    if (!soa->x || !soa->y || !soa->z || !soa->r || !soa->cr || !soa->cg || !soa->cb) {
+        sphere_soa_free(soa);
+        return -1;
+    }
+    return 0;
+}
+
+void sphere_soa_set(sphere_soa_t *soa, size_t k, const sphere_t *s)
+{
+    soa->x[k] = s->pos.x;
+    soa->y[k] = s->pos.y;
+    soa->z[k] = s->pos.z;
+    soa->r[k] = s->r;
+    soa->cr[k] = s->color.x;
+    soa->cg[k] = s->color.y;
+    soa->cb[k] = s->color.z;
+}
+
+void sphere_soa_free(sphere_soa_t *soa)
+{
+    free(soa->x);
+    free(soa->y);
+    free(soa->z);
+    free(soa->r);
+    free(soa->cr);
+    free(soa->cg);
+    free(soa->cb);
+    memset(soa, 0, sizeof(sphere_soa_t));
+}
+
+int triangle_soa_init(triangle_soa_t *soa, size_t num)
+{
+    real_t **arrays[9] = {
+        &soa->ax, &soa->ay, &soa->az, &soa->e1x, &soa->e1y, &soa->e1z, &soa->e2x, &soa->e2y, &soa->e2z,
+    };
+    soa->num = num;
+    bool ok = true;
+    for (int k = 0; k < 9; k++)
+        ok = (*arrays[k] = soa_array(num)) && ok;
+
+    if (!ok) {
+        triangle_soa_free(soa);
+        return -1;
+    }
+    return 0;
+}
+
+void triangle_soa_set(triangle_soa_t *soa, size_t k, const triangle_t *tri)
+{
+    const vec3 *v = tri->mesh->vertices;
+    vec3 a = v[tri->v[0]], e1, e2;
+    vec3_sub(v[tri->v[1]], a, &e1);
+    vec3_sub(v[tri->v[2]], a, &e2);
+
+    soa->ax[k] = a.x;
+    soa->ay[k] = a.y;
+    soa->az[k] = a.z;
+    soa->e1x[k] = e1.x;
+    soa->e1y[k] = e1.y;
+    soa->e1z[k] = e1.z;
+    soa->e2x[k] = e2.x;
+    soa->e2y[k] = e2.y;
+    soa->e2z[k] = e2.z;
+}
+
+void triangle_soa_free(triangle_soa_t *soa)
+{
+    free(soa->ax);
+    free(soa->ay);
+    free(soa->az);
+    free(soa->e1x);
+    free(soa->e1y);
+    free(soa->e1z);
+    free(soa->e2x);
+    free(soa->e2y);
+    free(soa->e2z);
+    memset(soa, 0, sizeof(triangle_soa_t));
+}
+
+////////////////////////////////////
+// SPHERES
+////////////////////////////////////
+
+static unsigned sphere_intersect_scalar(const sphere_soa_t *soa, size_t first, size_t n, vec3 o, vec3 d, float *t)
+{
+    unsigned hits = 0;
+    for (size_t k = 0; k < n; k++) {
+        size_t s = first + k;
+        real_t mx = o.x - soa->x[s], my = o.y - soa->y[s], mz = o.z - soa->z[s];
+        real_t b = mx * d.x + my * d.y + mz * d.z;
+        real_t c = (mx * mx + my * my + mz * mz) - soa->r[s] * soa->r[s];
+
+        if (c > 0.0 && b > 0.0) continue;
+
+        float discr = b*b - c;
+        if (discr < 0.0) continue;
+
+        float tk = -b - real_sqrt(discr);
+        t[k] = tk < 0.0 ? 0.0 : tk;
+        hits |= 1u << k;
+    }
+    return hits;
+}
+
+#if defined(KERNELS_X86) && defined(LUX_FLOAT)
+
+__attribute__((target("sse2")))
+static unsigned sphere_intersect_sse2(const sphere_soa_t *soa, size_t first, size_t n, vec3 o, vec3 d, float *t)
+{
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    unsigned hits = 0;
+
+    // four spheres per pass
+    for (size_t k = 0; k < n; k += 4) {
+        size_t s = first + k;
+        __m128 mx = _mm_sub_ps(_mm_set1_ps(o.x), _mm_loadu_ps(soa->x + s));
+        __m128 my = _mm_sub_ps(_mm_set1_ps(o.y), _mm_loadu_ps(soa->y + s));
+        __m128 mz = _mm_sub_ps(_mm_set1_ps(o.z), _mm_loadu_ps(soa->z + s));
+        __m128 r = _mm_loadu_ps(soa->r + s);
+
+        __m128 b = _mm_add_ps(_mm_add_ps(_mm_mul_ps(mx, _mm_set1_ps(d.x)),
+                   _mm_mul_ps(my, _mm_set1_ps(d.y))), _mm_mul_ps(mz, _mm_set1_ps(d.z)));
+        __m128 mm = _mm_add_ps(_mm_add_ps(_mm_mul_ps(mx, mx), _mm_mul_ps(my, my)), _mm_mul_ps(mz, mz));
+        __m128 c = _mm_sub_ps(mm, _mm_mul_ps(r, r));
+
+        __m128 away = _mm_and_ps(_mm_cmpgt_ps(c, zero), _mm_cmpgt_ps(b, zero));
+        __m128 discr = _mm_sub_ps(_mm_mul_ps(b, b), c);
+        __m128 miss = _mm_cmplt_ps(discr, zero);
+
+        __m128 tk = _mm_sub_ps(_mm_xor_ps(b, sign), _mm_sqrt_ps(discr));
+        tk = _mm_andnot_ps(_mm_cmplt_ps(tk, zero), tk);
+
+        float lanes[4];
+        _mm_storeu_ps(lanes, tk);
+        unsigned mask = ~(_mm_movemask_ps(away) | _mm_movemask_ps(miss)) & 15;
+        for (size_t l = 0; l < 4 && k + l < n; l++) {
+            t[k + l] = lanes[l];
+            if (mask & (1u << l))
+                hits |= 1u << (k + l);
+        }
+    }
+    return hits;
+}
+
+__attribute__((target("avx2")))
+static unsigned sphere_intersect_avx2(const sphere_soa_t *soa, size_t first, size_t n, vec3 o, vec3 d, float *t)
+{
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+
+    __m256 mx = _mm256_sub_ps(_mm256_set1_ps(o.x), _mm256_loadu_ps(soa->x + first));
+    __m256 my = _mm256_sub_ps(_mm256_set1_ps(o.y), _mm256_loadu_ps(soa->y + first));
+    __m256 mz = _mm256_sub_ps(_mm256_set1_ps(o.z), _mm256_loadu_ps(soa->z + first));
+    __m256 r = _mm256_loadu_ps(soa->r + first);
+
+    __m256 b = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(mx, _mm256_set1_ps(d.x)),
+               _mm256_mul_ps(my, _mm256_set1_ps(d.y))), _mm256_mul_ps(mz, _mm256_set1_ps(d.z)));
+    __m256 mm = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(mx, mx), _mm256_mul_ps(my, my)), _mm256_mul_ps(mz, mz));
+    __m256 c = _mm256_sub_ps(mm, _mm256_mul_ps(r, r));
+
+    __m256 away = _mm256_and_ps(_mm256_cmp_ps(c, zero, _CMP_GT_OQ), _mm256_cmp_ps(b, zero, _CMP_GT_OQ));
+    __m256 discr = _mm256_sub_ps(_mm256_mul_ps(b, b), c);
+    __m256 miss = _mm256_cmp_ps(discr, zero, _CMP_LT_OQ);
+
+    __m256 tk = _mm256_sub_ps(_mm256_xor_ps(b, sign), _mm256_sqrt_ps(discr));
+    tk = _mm256_andnot_ps(_mm256_cmp_ps(tk, zero, _CMP_LT_OQ), tk);
+
+    _mm256_storeu_ps(t, tk);
+    unsigned lanes = (1u << n) - 1;
+    return ~(_mm256_movemask_ps(away) | _mm256_movemask_ps(miss)) & lanes;
+}
+
+#elif defined(KERNELS_X86)
+
+__attribute__((target("sse2")))
+static unsigned sphere_intersect_sse2(const sphere_soa_t *soa, size_t first, size_t n, vec3 o, vec3 d, float *t)
+{
+    const __m128d zero = _mm_setzero_pd();
+    const __m128d sign = _mm_set1_pd(-0.0);
+    unsigned hits = 0;
+
+    // two spheres per pass
+    for (size_t k = 0; k < n; k += 2) {
+        size_t s = first + k;
+        __m128d mx = _mm_sub_pd(_mm_set1_pd(o.x), _mm_loadu_pd(soa->x + s));
+        __m128d my = _mm_sub_pd(_mm_set1_pd(o.y), _mm_loadu_pd(soa->y + s));
+        __m128d mz = _mm_sub_pd(_mm_set1_pd(o.z), _mm_loadu_pd(soa->z + s));
+        __m128d r = _mm_loadu_pd(soa->r + s);
+
+        __m128d b = _mm_add_pd(_mm_add_pd(_mm_mul_pd(mx, _mm_set1_pd(d.x)),
+                    _mm_mul_pd(my, _mm_set1_pd(d.y))), _mm_mul_pd(mz, _mm_set1_pd(d.z)));
+        __m128d mm = _mm_add_pd(_mm_add_pd(_mm_mul_pd(mx, mx), _mm_mul_pd(my, my)), _mm_mul_pd(mz, mz));
+        __m128d c = _mm_sub_pd(mm, _mm_mul_pd(r, r));
+
+        __m128d away = _mm_and_pd(_mm_cmpgt_pd(c, zero), _mm_cmpgt_pd(b, zero));
+        __m128 discr = _mm_cvtpd_ps(_mm_sub_pd(_mm_mul_pd(b, b), c));
+        __m128 miss = _mm_cmplt_ps(discr, _mm_setzero_ps());
+
+        __m128d root = _mm_sqrt_pd(_mm_cvtps_pd(discr));
+        __m128 tk = _mm_cvtpd_ps(_mm_sub_pd(_mm_xor_pd(b, sign), root));
+        tk = _mm_andnot_ps(_mm_cmplt_ps(tk, _mm_setzero_ps()), tk);
+
+        float lanes[4];
+        _mm_storeu_ps(lanes, tk);
+        unsigned mask = ~(_mm_movemask_pd(away) | (_mm_movemask_ps(miss) & 3)) & 3;
+        for (size_t l = 0; l < 2 && k + l < n; l++) {
+            t[k + l] = lanes[l];
+            if (mask & (1u << l))
+                hits |= 1u << (k + l);
+        }
+    }
+    return hits;
+}
+
+__attribute__((target("avx2")))
+static unsigned sphere_intersect_avx2(const sphere_soa_t *soa, size_t first, size_t n, vec3 o, vec3 d, float *t)
+{
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d sign = _mm256_set1_pd(-0.0);
+
+    __m256d mx = _mm256_sub_pd(_mm256_set1_pd(o.x), _mm256_loadu_pd(soa->x + first));
+    __m256d my = _mm256_sub_pd(_mm256_set1_pd(o.y), _mm256_loadu_pd(soa->y + first));
+    __m256d mz = _mm256_sub_pd(_mm256_set1_pd(o.z), _mm256_loadu_pd(soa->z + first));
+    __m256d r = _mm256_loadu_pd(soa->r + first);
+
+    // explicit mul/add (no fma) keeps the rounding of the scalar test
+    __m256d b = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(mx, _mm256_set1_pd(d.x)),
+                _mm256_mul_pd(my, _mm256_set1_pd(d.y))), _mm256_mul_pd(mz, _mm256_set1_pd(d.z)));
+    __m256d mm = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(mx, mx), _mm256_mul_pd(my, my)), _mm256_mul_pd(mz, mz));
+    __m256d c = _mm256_sub_pd(mm, _mm256_mul_pd(r, r));
+
+    __m256d away = _mm256_and_pd(_mm256_cmp_pd(c, zero, _CMP_GT_OQ), _mm256_cmp_pd(b, zero, _CMP_GT_OQ));
+    __m128 discr = _mm256_cvtpd_ps(_mm256_sub_pd(_mm256_mul_pd(b, b), c));
+    __m128 miss = _mm_cmplt_ps(discr, _mm_setzero_ps());
+
+    __m256d root = _mm256_sqrt_pd(_mm256_cvtps_pd(discr));
+    __m128 tk = _mm256_cvtpd_ps(_mm256_sub_pd(_mm256_xor_pd(b, sign), root));
+    tk = _mm_andnot_ps(_mm_cmplt_ps(tk, _mm_setzero_ps()), tk);
+
+    _mm_storeu_ps(t, tk);
+    unsigned lanes = (1u << n) - 1;
+    return ~(_mm256_movemask_pd(away) | _mm_movemask_ps(miss)) & lanes;
+}
+
+#endif
+
+////////////////////////////////////
+// TRIANGLES
+////////////////////////////////////
+
+static unsigned triangle_intersect_scalar(const triangle_soa_t *soa, size_t first, size_t n, vec3 o, vec3 d, float *t)
+{
+    unsigned hits = 0;
+    for (size_t k = 0; k < n; k++) {
+        size_t s = first + k;
+        vec3 e1 = { soa->e1x[s], soa->e1y[s], soa->e1z[s] };
+        vec3 e2 = { soa->e2x[s], soa->e2y[s], soa->e2z[s] };
+
+        vec3 p;
+        vec3_cross(d, e2, &p);
+        real_t det = vec3_dot(e1, p);
+        if (det == 0.0) continue;
+        real_t inv = 1 / det;
+
+        vec3 m = { o.x - soa->ax[s], o.y - soa->ay[s], o.z - soa->az[s] };
+        real_t u = vec3_dot(m, p) * inv;
+        if (!(u >= 0.0 && u <= 1.0)) continue;
+
+        vec3 q;
+        vec3_cross(m, e1, &q);
+        real_t w = vec3_dot(d, q) * inv;
+        if (!(w >= 0.0 && u + w <= 1.0)) continue;
+
+        real_t tk = vec3_dot(e2, q) * inv;
+        if (!(tk > 0.0)) continue;
+
+        t[k] = tk;
+        hits |= 1u << k;
+    }
+    return hits;
+}
+
+/*
+ * The vector versions below compute every lane with the operation order of
+ * the scalar test: p = d x e2, det = e1.p, m = o - a, u = (m.p) / det,
+ * q = m x e1, w = (d.q) / det, t = (e2.q) / det, and keep the lanes where
+ * det != 0, 0 <= u <= 1, w >= 0, u + w <= 1 and t > 0 (ordered compares, so
+ * NaN lanes drop out).
+ */
+
+#if defined(KERNELS_X86) && defined(LUX_FLOAT)
+
+__attribute__((target("sse2")))
+static unsigned triangle_intersect_sse2(const triangle_soa_t *soa, size_t first, size_t n, vec3 o, vec3 d, float *t)
+{
+    const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+    const __m128 dx = _mm_set1_ps(d.x), dy = _mm_set1_ps(d.y), dz = _mm_set1_ps(d.z);
+    unsigned hits = 0;
+
+    // four triangles per pass
+    for (size_t k = 0; k < n; k += 4) {
+        size_t s = first + k;
+        __m128 e1x = _mm_loadu_ps(soa->e1x + s), e1y = _mm_loadu_ps(soa->e1y + s), e1z = _mm_loadu_ps(soa->e1z + s);
+        __m128 e2x = _mm_loadu_ps(soa->e2x + s), e2y = _mm_loadu_ps(soa->e2y + s), e2z = _mm_loadu_ps(soa->e2z + s);
+
+        __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+        __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+        __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+        __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+        __m128 inv = _mm_div_ps(one, det);
+
+        __m128 mx = _mm_sub_ps(_mm_set1_ps(o.x), _mm_loadu_ps(soa->ax + s));
+        __m128 my = _mm_sub_ps(_mm_set1_ps(o.y), _mm_loadu_ps(soa->ay + s));
+        __m128 mz = _mm_sub_ps(_mm_set1_ps(o.z), _mm_loadu_ps(soa->az + s));
+        __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(mx, px), _mm_mul_ps(my, py)), _mm_mul_ps(mz, pz)), inv);
+
+        __m128 qx = _mm_sub_ps(_mm_mul_ps(my, e1z), _mm_mul_ps(mz, e1y));
+        __m128 qy = _mm_sub_ps(_mm_mul_ps(mz, e1x), _mm_mul_ps(mx, e1z));
+        __m128 qz = _mm_sub_ps(_mm_mul_ps(mx, e1y), _mm_mul_ps(my, e1x));
+        __m128 w = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), inv);
+        __m128 tk = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inv);
+
+        __m128 ok = _mm_and_ps(_mm_cmpneq_ps(det, zero), _mm_cmpge_ps(u, zero));
+        ok = _mm_and_ps(ok, _mm_and_ps(_mm_cmple_ps(u, one), _mm_cmpge_ps(w, zero)));
+        ok = _mm_and_ps(ok, _mm_and_ps(_mm_cmple_ps(_mm_add_ps(u, w), one), _mm_cmpgt_ps(tk, zero)));
+
+        float lanes[4];
+        _mm_storeu_ps(lanes, tk);
+        unsigned mask = _mm_movemask_ps(ok);
+        for (size_t l = 0; l < 4 && k + l < n; l++) {
+            t[k + l] = lanes[l];
+            if (mask & (1u << l))
+                hits |= 1u << (k + l);
+        }
+    }
+    return hits;
+}
+
+__attribute__((target("avx2")))
+static unsigned triangle_intersect_avx2(const triangle_soa_t *soa, size_t first, size_t n, vec3 o, vec3 d, float *t)
+{
+    const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f);
+    const __m256 dx = _mm256_set1_ps(d.x), dy = _mm256_set1_ps(d.y), dz = _mm256_set1_ps(d.z);
+    __m256 e1x = _mm256_loadu_ps(soa->e1x + first), e1y = _mm256_loadu_ps(soa->e1y + first);
+    __m256 e1z = _mm256_loadu_ps(soa->e1z + first), e2x = _mm256_loadu_ps(soa->e2x + first);
+    __m256 e2y = _mm256_loadu_ps(soa->e2y + first), e2z = _mm256_loadu_ps(soa->e2z + first);
+
+    __m256 px = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+    __m256 py = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+    __m256 pz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+    __m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)), _mm256_mul_ps(e1z, pz));
+    __m256 inv = _mm256_div_ps(one, det);
+
+    __m256 mx = _mm256_sub_ps(_mm256_set1_ps(o.x), _mm256_loadu_ps(soa->ax + first));
+    __m256 my = _mm256_sub_ps(_mm256_set1_ps(o.y), _mm256_loadu_ps(soa->ay + first));
+    __m256 mz = _mm256_sub_ps(_mm256_set1_ps(o.z), _mm256_loadu_ps(soa->az + first));
+    __m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(mx, px), _mm256_mul_ps(my, py)),
+                             _mm256_mul_ps(mz, pz)), inv);
+
+    __m256 qx = _mm256_sub_ps(_mm256_mul_ps(my, e1z), _mm256_mul_ps(mz, e1y));
+    __m256 qy = _mm256_sub_ps(_mm256_mul_ps(mz, e1x), _mm256_mul_ps(mx, e1z));
+    __m256 qz = _mm256_sub_ps(_mm256_mul_ps(mx, e1y), _mm256_mul_ps(my, e1x));
+    __m256 w = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)),
+                             _mm256_mul_ps(dz, qz)), inv);
+    __m256 tk = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)),
+                              _mm256_mul_ps(e2z, qz)), inv);
+
+    __m256 ok = _mm256_and_ps(_mm256_cmp_ps(det, zero, _CMP_NEQ_OQ), _mm256_cmp_ps(u, zero, _CMP_GE_OQ));
+    ok = _mm256_and_ps(ok, _mm256_and_ps(_mm256_cmp_ps(u, one, _CMP_LE_OQ), _mm256_cmp_ps(w, zero, _CMP_GE_OQ)));
+    ok = _mm256_and_ps(ok, _mm256_and_ps(_mm256_cmp_ps(_mm256_add_ps(u, w), one, _CMP_LE_OQ),
+                                         _mm256_cmp_ps(tk, zero, _CMP_GT_OQ)));
+
+    _mm256_storeu_ps(t, tk);
+    unsigned lanes = (1u << n) - 1;
+    return _mm256_movemask_ps(ok) & lanes;
+}
+
+#elif defined(KERNELS_X86)
+
+__attribute__((target("sse2")))
+static unsigned triangle_intersect_sse2(const triangle_soa_t *soa, size_t first, size_t n, vec3 o, vec3 d, float *t)
+{
+    const __m128d zero = _mm_setzero_pd(), one = _mm_set1_pd(1.0);
+    const __m128d dx = _mm_set1_pd(d.x), dy = _mm_set1_pd(d.y), dz = _mm_set1_pd(d.z);
+    unsigned hits = 0;
+
+    // two triangles per pass
+    for (size_t k = 0; k < n; k += 2) {
+        size_t s = first + k;
+        __m128d e1x = _mm_loadu_pd(soa->e1x + s), e1y = _mm_loadu_pd(soa->e1y + s), e1z = _mm_loadu_pd(soa->e1z + s);
+        __m128d e2x = _mm_loadu_pd(soa->e2x + s), e2y = _mm_loadu_pd(soa->e2y + s), e2z = _mm_loadu_pd(soa->e2z + s);
+
+        __m128d px = _mm_sub_pd(_mm_mul_pd(dy, e2z), _mm_mul_pd(dz, e2y));
+        __m128d py = _mm_sub_pd(_mm_mul_pd(dz, e2x), _mm_mul_pd(dx, e2z));
+        __m128d pz = _mm_sub_pd(_mm_mul_pd(dx, e2y), _mm_mul_pd(dy, e2x));
+        __m128d det = _mm_add_pd(_mm_add_pd(_mm_mul_pd(e1x, px), _mm_mul_pd(e1y, py)), _mm_mul_pd(e1z, pz));
+        __m128d inv = _mm_div_pd(one, det);
+
+        __m128d mx = _mm_sub_pd(_mm_set1_pd(o.x), _mm_loadu_pd(soa->ax + s));
+        __m128d my = _mm_sub_pd(_mm_set1_pd(o.y), _mm_loadu_pd(soa->ay + s));
+        __m128d mz = _mm_sub_pd(_mm_set1_pd(o.z), _mm_loadu_pd(soa->az + s));
+        __m128d u = _mm_mul_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(mx, px), _mm_mul_pd(my, py)), _mm_mul_pd(mz, pz)), inv);
+
+        __m128d qx = _mm_sub_pd(_mm_mul_pd(my, e1z), _mm_mul_pd(mz, e1y));
+        __m128d qy = _mm_sub_pd(_mm_mul_pd(mz, e1x), _mm_mul_pd(mx, e1z));
+        __m128d qz = _mm_sub_pd(_mm_mul_pd(mx, e1y), _mm_mul_pd(my, e1x));
+        __m128d w = _mm_mul_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(dx, qx), _mm_mul_pd(dy, qy)), _mm_mul_pd(dz, qz)), inv);
+        __m128d tk = _mm_mul_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(e2x, qx), _mm_mul_pd(e2y, qy)), _mm_mul_pd(e2z, qz)), inv);
+
+        __m128d ok = _mm_and_pd(_mm_cmpneq_pd(det, zero), _mm_cmpge_pd(u, zero));
+        ok = _mm_and_pd(ok, _mm_and_pd(_mm_cmple_pd(u, one), _mm_cmpge_pd(w, zero)));
+        ok = _mm_and_pd(ok, _mm_and_pd(_mm_cmple_pd(_mm_add_pd(u, w), one), _mm_cmpgt_pd(tk, zero)));
+
+        float lanes[4];
+        _mm_storeu_ps(lanes, _mm_cvtpd_ps(tk));
+        unsigned mask = _mm_movemask_pd(ok);
+        for (size_t l = 0; l < 2 && k + l < n; l++) {
+            t[k + l] = lanes[l];
+            if (mask & (1u << l))
+                hits |= 1u << (k + l);
+        }
+    }
+    return hits;
+}
+
+__attribute__((target("avx2")))
+static unsigned triangle_intersect_avx2(const triangle_soa_t *soa, size_t first, size_t n, vec3 o, vec3 d, float *t)
+{
+    const __m256d zero = _mm256_setzero_pd(), one = _mm256_set1_pd(1.0);
+    const __m256d dx = _mm256_set1_pd(d.x), dy = _mm256_set1_pd(d.y), dz = _mm256_set1_pd(d.z);
+    __m256d e1x = _mm256_loadu_pd(soa->e1x + first), e1y = _mm256_loadu_pd(soa->e1y + first);
+    __m256d e1z = _mm256_loadu_pd(soa->e1z + first), e2x = _mm256_loadu_pd(soa->e2x + first);
+    __m256d e2y = _mm256_loadu_pd(soa->e2y + first), e2z = _mm256_loadu_pd(soa->e2z + first);
+
+    // explicit mul/add (no fma) keeps the rounding of the scalar test
+    __m256d px = _mm256_sub_pd(_mm256_mul_pd(dy, e2z), _mm256_mul_pd(dz, e2y));
+    __m256d py = _mm256_sub_pd(_mm256_mul_pd(dz, e2x), _mm256_mul_pd(dx, e2z));
+    __m256d pz = _mm256_sub_pd(_mm256_mul_pd(dx, e2y), _mm256_mul_pd(dy, e2x));
+    __m256d det = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(e1x, px), _mm256_mul_pd(e1y, py)), _mm256_mul_pd(e1z, pz));
+    __m256d inv = _mm256_div_pd(one, det);
+
+    __m256d mx = _mm256_sub_pd(_mm256_set1_pd(o.x), _mm256_loadu_pd(soa->ax + first));
+    __m256d my = _mm256_sub_pd(_mm256_set1_pd(o.y), _mm256_loadu_pd(soa->ay + first));
+    __m256d mz = _mm256_sub_pd(_mm256_set1_pd(o.z), _mm256_loadu_pd(soa->az + first));
+    __m256d u = _mm256_mul_pd(_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(mx, px), _mm256_mul_pd(my, py)),
+                              _mm256_mul_pd(mz, pz)), inv);
+
+    __m256d qx = _mm256_sub_pd(_mm256_mul_pd(my, e1z), _mm256_mul_pd(mz, e1y));
+    __m256d qy = _mm256_sub_pd(_mm256_mul_pd(mz, e1x), _mm256_mul_pd(mx, e1z));
+    __m256d qz = _mm256_sub_pd(_mm256_mul_pd(mx, e1y), _mm256_mul_pd(my, e1x));
+    __m256d w = _mm256_mul_pd(_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, qx), _mm256_mul_pd(dy, qy)),
+                              _mm256_mul_pd(dz, qz)), inv);
+    __m256d tk = _mm256_mul_pd(_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(e2x, qx), _mm256_mul_pd(e2y, qy)),
+                               _mm256_mul_pd(e2z, qz)), inv);
+
+    __m256d ok = _mm256_and_pd(_mm256_cmp_pd(det, zero, _CMP_NEQ_OQ), _mm256_cmp_pd(u, zero, _CMP_GE_OQ));
+    ok = _mm256_and_pd(ok, _mm256_and_pd(_mm256_cmp_pd(u, one, _CMP_LE_OQ), _mm256_cmp_pd(w, zero, _CMP_GE_OQ)));
+    ok = _mm256_and_pd(ok, _mm256_and_pd(_mm256_cmp_pd(_mm256_add_pd(u, w), one, _CMP_LE_OQ),
+                                         _mm256_cmp_pd(tk, zero, _CMP_GT_OQ)));
+
+    _mm_storeu_ps(t, _mm256_cvtpd_ps(tk));
+    unsigned lanes = (1u << n) - 1;
+    return _mm256_movemask_pd(ok) & lanes;
+}
+
+#endif
+
+sphere_kernel *sphere_intersect = &sphere_intersect_scalar;
+triangle_kernel *triangle_intersect = &triangle_intersect_scalar;
+
+static const char *kernels_name = "scalar";
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+/* [kernels_select] set each kernel pointer once, before any traversal reads it */
+static void kernels_select(void)
+{
+    const char *force = getenv("LUX_SIMD");
+
+    if (force && strcmp(force, "scalar") == 0)
+        return;
+
+#ifdef KERNELS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && !(force && strcmp(force, "sse2") == 0)) {
+        sphere_intersect = &sphere_intersect_avx2;
+        triangle_intersect = &triangle_intersect_avx2;
+        kernels_name = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        sphere_intersect = &sphere_intersect_sse2;
+        triangle_intersect = &triangle_intersect_sse2;
+        kernels_name = "sse2";
+    }
+#endif
+}
+
+/*
+ * [kernels_init] pick the widest kernels this CPU runs, returns their name
+ * Only the first call picks; later ones, from any thread, return the same name.
+ */
+const char *kernels_init(void)
+{
+    pthread_once(&kernels_once, kernels_select);
+    return kernels_name;
+}
@@ -0,0 +1,61 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include "geometry.h"
+
+/* number of objects a kernel call tests at most: 4 doubles or 8 floats per AVX2 register */
+#ifdef LUX_FLOAT
+#define KERNEL_LANES 8
+#else
+#define KERNEL_LANES 4
+#endif
+
+/*
+ * Structure-of-arrays sphere storage. Every array is 32-byte aligned and padded
+ * to a whole number of lanes past num, so kernels can always load full vectors.
+ */
+typedef struct {
+    real_t *x, *y, *z, *r;
+    real_t *cr, *cg, *cb;
+    size_t num;
+} sphere_soa_t;
+
+int sphere_soa_init(sphere_soa_t *soa, size_t num);
+void sphere_soa_set(sphere_soa_t *soa, size_t k, const sphere_t *s);
+void sphere_soa_free(sphere_soa_t *soa);
+
+/* structure-of-arrays triangles: first corner and the two edges leaving it */
+typedef struct {
+    real_t *ax, *ay, *az;
+    real_t *e1x, *e1y, *e1z;
+    real_t *e2x, *e2y, *e2z;
+    size_t num;
+} triangle_soa_t;
+
+int triangle_soa_init(triangle_soa_t *soa, size_t num);
+void triangle_soa_set(triangle_soa_t *soa, size_t k, const triangle_t *tri);
+void triangle_soa_free(triangle_soa_t *soa);
+
+/*
+ * [sphere_kernel] test a ray against packed spheres [first, first + n), n <= KERNEL_LANES
+ *   soa: packed spheres
+ *   first, n: range of spheres to test
+ *   o: ray origin
+ *   d: normalized ray direction
+ *   t: where to write the depth of each sphere (KERNEL_LANES floats)
+ * returns a bitmask of the spheres hit; results match test_ray_sphere bit for bit
+ */
+typedef unsigned sphere_kernel(const sphere_soa_t *soa, size_t first, size_t n, vec3 o, vec3 d, float *t);
+
+/*
+ * [triangle_kernel] test a ray against packed triangles [first, first + n), n <= KERNEL_LANES
+ * Same contract as sphere_kernel; results match test_ray_triangle bit for bit.
+ */
+typedef unsigned triangle_kernel(const triangle_soa_t *soa, size_t first, size_t n, vec3 o, vec3 d, float *t);
+
+extern sphere_kernel *sphere_intersect;
+extern triangle_kernel *triangle_intersect;
+
+const char *kernels_init(void);
+
+#endif
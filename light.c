@@ -0,0 +1,115 @@
+#include "light.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* [cell_range] cells [lo, hi] along each axis that a light's sphere overlaps */
+static void cell_range(const light_grid_t *grid, const light_t *light, size_t *lo, size_t *hi)
+{
+    real_t p[3] = { light->pos.x, light->pos.y, light->pos.z };
+    real_t o[3] = { grid->origin.x, grid->origin.y, grid->origin.z };
+    real_t s[3] = { grid->scale.x, grid->scale.y, grid->scale.z };
+    for (int a = 0; a < 3; a++) {
+        real_t l = (p[a] - light->radius - o[a]) * s[a];
+        real_t h = (p[a] + light->radius - o[a]) * s[a];
+        lo[a] = l > 0.0 ? (size_t) l : 0;
+        hi[a] = h > 0.0 ? (size_t) h : 0;
+        if (lo[a] >= grid->dims[a]) lo[a] = grid->dims[a] - 1;
+        if (hi[a] >= grid->dims[a]) hi[a] = grid->dims[a] - 1;
+    }
+}
+
+/*
+ * [light_grid_build] sort lights into a grid
+ *   grid: grid to fill, free with light_grid_free
+ *   lights: lights, indexed by the grid
+ *   num: number of lights
+ *
+ * Cells are about the size of an average sphere of influence, so a light
+ * lands in a handful of cells and a cell holds a handful of lights.
+ */
+int light_grid_build(light_grid_t *grid, const light_t *lights, size_t num)
+{
+    memset(grid, 0, sizeof(light_grid_t));
+    grid->unbounded = malloc(sizeof(uint32_t) * (num + 1));
+    if (!grid->unbounded)
+        return -1;
+
+    vec3 min = { REAL_MAX, REAL_MAX, REAL_MAX }, max = { -REAL_MAX, -REAL_MAX, -REAL_MAX };
+    real_t radii = 0.0;
+    size_t bounded = 0;
+    for (size_t k = 0; k < num; k++) {
+        const light_t *l = &lights[k];
+        if (l->radius <= 0.0) {
+            grid->unbounded[grid->unbounded_num++] = k;
+            continue;
+        }
+        min = (vec3) { real_min(min.x, l->pos.x - l->radius), real_min(min.y, l->pos.y - l->radius),
+                       real_min(min.z, l->pos.z - l->radius) };
+        max = (vec3) { real_max(max.x, l->pos.x + l->radius), real_max(max.y, l->pos.y + l->radius),
+                       real_max(max.z, l->pos.z + l->radius) };
+        radii += l->radius;
+        bounded++;
+    }
+    if (!bounded)
+        return 0;
+
+    real_t cell = 2.0 * radii / bounded;
+    real_t ext[3] = { max.x - min.x, max.y - min.y, max.z - min.z };
+    real_t scale[3];
+    size_t cells = 1;
+    for (int a = 0; a < 3; a++) {
+        real_t d = ext[a] / cell;
+        grid->dims[a] = d < 1.0 ? 1 : d > LIGHT_GRID_DIM ? LIGHT_GRID_DIM : (size_t) d;
+        scale[a] = grid->dims[a] / ext[a];
+        cells *= grid->dims[a];
+    }
+    grid->origin = min;
+    grid->scale = (vec3) { scale[0], scale[1], scale[2] };
+
+    // two passes: count the lights of each cell, then fill them in light order
+    grid->start = calloc(cells + 1, sizeof(uint32_t));
+    if (!grid->start) {
+        light_grid_free(grid);
+        return -1;
+    }
+    size_t lo[3], hi[3];
+    for (size_t k = 0; k < num; k++) {
+        if (lights[k].radius <= 0.0)
+            continue;
+        cell_range(grid, &lights[k], lo, hi);
+        for (size_t z = lo[2]; z <= hi[2]; z++)
+            for (size_t y = lo[1]; y <= hi[1]; y++)
+                for (size_t x = lo[0]; x <= hi[0]; x++)
+                    grid->start[(z * grid->dims[1] + y) * grid->dims[0] + x + 1]++;
+    }
+    for (size_t c = 0; c < cells; c++)
+        grid->start[c + 1] += grid->start[c];
+
+    grid->index = malloc(sizeof(uint32_t) * (grid->start[cells] + 1));
+    uint32_t *fill = malloc(sizeof(uint32_t) * cells);
+    if (!grid->index || !fill) {
+        free(fill);
+        light_grid_free(grid);
+        return -1;
+    }
+    memcpy(fill, grid->start, sizeof(uint32_t) * cells);
+    for (size_t k = 0; k < num; k++) {
+        if (lights[k].radius <= 0.0)
+            continue;
+        cell_range(grid, &lights[k], lo, hi);
+        for (size_t z = lo[2]; z <= hi[2]; z++)
+            for (size_t y = lo[1]; y <= hi[1]; y++)
+                for (size_t x = lo[0]; x <= hi[0]; x++)
+                    grid->index[fill[(z * grid->dims[1] + y) * grid->dims[0] + x]++] = k;
+    }
+    free(fill);
+    return 0;
+}
+
+void light_grid_free(light_grid_t *grid)
+{
+    free(grid->start);
+    free(grid->index);
+    free(grid->unbounded);
+    memset(grid, 0, sizeof(light_grid_t));
+}
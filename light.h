@@ -0,0 +1,78 @@
+#ifndef LIGHT_H
+#define LIGHT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "vec3.h"
+
+/* point light; its contribution fades to 0 at radius, 0 for a light reaching everywhere */
+typedef struct {
+    vec3 pos;
+    vec3 color;
+    real_t radius;
+} light_t;
+
+/* most cells along each axis of a light grid */
+#define LIGHT_GRID_DIM 32
+
+/*
+ * Uniform grid over the spheres of influence of the lights. Each cell lists
+ * the lights whose sphere overlaps it, so a shading point only looks at the
+ * few lights that can reach it; lights without a radius are kept apart.
+ */
+typedef struct {
+    vec3 origin;
+    /* cells per unit along each axis */
+    vec3 scale;
+    size_t dims[3];
+    /* cell c lists index[start[c]] to index[start[c + 1] - 1], in light order */
+    uint32_t *start;
+    uint32_t *index;
+    uint32_t *unbounded;
+    size_t unbounded_num;
+} light_grid_t;
+
+int light_grid_build(light_grid_t *grid, const light_t *lights, size_t num);
+void light_grid_free(light_grid_t *grid);
+
+/*
+ * [light_grid_cell] lights with a radius that may reach a point
+ *   grid: light grid
+ *   p: point
+ *   lights: out: their indices, in light order
+ * returns their number
+ */
+static inline size_t light_grid_cell(const light_grid_t *grid, vec3 p, const uint32_t **lights)
+{
+    if (!grid->start)
+        return 0;
+
+    real_t at[3] = {
+        (p.x - grid->origin.x) * grid->scale.x,
+        (p.y - grid->origin.y) * grid->scale.y,
+        (p.z - grid->origin.z) * grid->scale.z,
+    };
+    size_t cell = 0;
+    for (int a = 2; a >= 0; a--) {
+        // written so that NaNs fall outside as well
+        if (!(at[a] >= 0.0 && at[a] < grid->dims[a]))
+            return 0;
+        cell = cell * grid->dims[a] + (size_t) at[a];
+    }
+
+    *lights = &grid->index[grid->start[cell]];
+    return grid->start[cell + 1] - grid->start[cell];
+}
+
+/* [light_falloff] weight of a light at squared distance d2, 1 near the light down to 0 at its radius */
+static inline real_t light_falloff(const light_t *light, real_t d2)
+{
+    if (light->radius <= 0.0)
+        return 1.0;
+    real_t x = d2 / (light->radius * light->radius);
+    if (x >= 1.0)
+        return 0.0;
+    return (1.0 - x) * (1.0 - x);
+}
+
+#endif
@@ -2,296 +2,704 @@
 #include <stdlib.h>
 #include <math.h>
 #include <float.h>
-#include "vec3.h"
-#include "camera.h"
-#include "ppm.h"
-#include "utlist.h"
+#include <string.h>
+#include "lux.h"
+#include "bvh.h"
+#include "geometry.h"
+#include "sched.h"
+#include "stats.h"
+#include "shadowmap.h"
+#include "path.h"
+#include "wavefront.h"
+#include "walk.h"
 
-typedef struct {
-    vec3 color;
-    float depth;
-} collision_t;
+/*
+ * [lux_occluded] whether anything blocks a ray before it travels max_t
+ *   lux: lux context, committed
+ *   source: ray origin
+ *   dir: normalized ray direction
+ *   max_t: distance to the point being checked for visibility (e.g. a light)
+ *
+ * Stops at the first occluder. Each thread remembers the last occluder it found
+ * and tries it first: neighbouring shadow rays tend to be blocked by the same object.
+ */
+bool lux_occluded(lux_t *lux, vec3 source, vec3 dir, real_t max_t)
+{
+    static _Thread_local struct {
+        uint64_t bvh;
+        bvh_ref_t ref;
+    } last;
+
+    if (last.bvh != lux->bvh->id) {
+        last.bvh = lux->bvh->id;
+        last.ref.job = LUX_NO_HIT;
+    }
 
-typedef bool collide(vec3, vec3, void*, collision_t*);
+    return bvh_occluded(lux->bvh, source, dir, max_t, &last.ref);
+}
 
-typedef struct job {
-    uint8_t *data;
-    size_t obj_size;
-    size_t obj_num;
-    collide *test;
-    struct job *next;
-} job_t;
+/*
+ * [light_sample] add what one light of the list brings to a G-buffer sample
+ *   lux: lux context
+ *   s: sample
+ *   l: index of the light
+ *   cutoff: weight below which the light is skipped
+ *   sum: light gathered so far
+ * returns the number of shadow rays cast (0 or 1)
+ *
+ * Lights out of reach, too faint or behind the surface cost no shadow ray,
+ * and neither do lights with a shadow map.
+ */
+static size_t light_sample(lux_t *lux, const gsample_t *s, uint32_t l, real_t cutoff, vec3 *sum)
+{
+    const light_t *light = &lux->lights[l];
+    vec3 to_light;
+    vec3_sub(light->pos, s->point, &to_light);
+    real_t w = light_falloff(light, vec3_dot(to_light, to_light));
+    if (w * real_max(light->color.x, real_max(light->color.y, light->color.z)) < cutoff
+        || vec3_dot(to_light, s->normal) <= 0.0)
+        return 0;
+
+    if (lux->shadow_map) {
+        vec3 c;
+        vec3_mul(light->color, w * shadow_map_visibility(lux->shadow_maps, l, s->point, s->normal, lux_shadow_bias(lux)), &c);
+        vec3_add(*sum, c, sum);
+        return 0;
+    }
 
-typedef struct {
-    ppm_t *ppm;
-    float *depth;
-    camera_t camera;
-    vec3 light;
-    job_t *jobs;
-} lux_t;
+    vec3 light_ray;
+    vec3_normalize(to_light, &light_ray);
+
+    // nudge a bit
+    vec3 source = light_ray;
+    vec3_mul(source, 0.001, &source);
+    vec3_add(s->point, source, &source);
+    vec3_sub(light->pos, source, &to_light);
+
+    bool occluded = lux_occluded(lux, source, light_ray, vec3_norm(to_light));
+    STATS_SHADOW(s->job, occluded);
+    if (!occluded) {
+        vec3 c;
+        vec3_mul(light->color, w, &c);
+        vec3_add(*sum, c, sum);
+    }
+    return 1;
+}
 
-////////////////////////////////////
-// GEOMETRY
-////////////////////////////////////
+/*
+ * [shade_sample] color of a G-buffer sample, 0-255 per channel
+ *   lux: lux context
+ *   s: sample, something was hit
+ *   shadow: incremented by the number of shadow rays cast
+ *
+ * Surfaces keep a fifth of their color in the shadow of every light; the
+ * light reaching them adds the rest, up to their full color.
+ */
+static vec3 shade_sample(lux_t *lux, const gsample_t *s, size_t *shadow)
+{
+    vec3 c;
+    vec3_mul(s->color, 255.0, &c);
 
-typedef struct {
-    vec3 color;
-    vec3 u, v; // orientation
-    vec3 p; // any point on the plane
-} plane_t;
+    if (lux->light_num == 0 && lux->shadow_map) {
+        vec3_mul(c, 0.2 + 0.8 * shadow_map_visibility(lux->shadow_maps, 0, s->point, s->normal, lux_shadow_bias(lux)), &c);
+        return c;
+    }
+    if (lux->light_num == 0) {
+        vec3 source = s->point;
+
+        // check if light source hits this
+        vec3 light_ray = lux->light;
+        vec3_sub(light_ray, source, &light_ray);
+        vec3_normalize(light_ray, &light_ray);
+
+        // nudge a bit
+        vec3 lil = light_ray;
+        vec3_mul(lil, 0.001, &lil);
+        vec3_add(source, lil, &source);
+
+        vec3 to_light;
+        vec3_sub(lux->light, source, &to_light);
+
+        // check if some object obstructs the direct path towards our light source
+        bool occluded = lux_occluded(lux, source, light_ray, vec3_norm(to_light));
+        if (occluded)
+            vec3_mul(c, 0.2, &c);
+        STATS_SHADOW(s->job, occluded);
+        (*shadow)++;
+        return c;
+    }
 
-bool test_ray_plane(vec3 camera, vec3 ray, void *obj, collision_t *col)
-{
-    plane_t *plane = (plane_t*) obj;
+    real_t cutoff = lux->light_cutoff > 0 ? lux->light_cutoff : LUX_LIGHT_CUTOFF;
+    const light_grid_t *grid = &lux->light_grid;
+    const uint32_t *near = NULL;
+    size_t near_num = light_grid_cell(grid, s->point, &near);
+    vec3 sum = { 0.0, 0.0, 0.0 };
 
-    vec3 m;
-    vec3_sub(camera, plane->p, &m);
-    vec3 n;
-    vec3_cross(plane->u, plane->v, &n);
+    // once every channel is saturated the remaining lights cannot change the color
+    for (size_t k = 0; k < grid->unbounded_num + near_num && (sum.x < 1.0 || sum.y < 1.0 || sum.z < 1.0); k++) {
+        uint32_t l = k < grid->unbounded_num ? grid->unbounded[k] : near[k - grid->unbounded_num];
+        *shadow += light_sample(lux, s, l, cutoff, &sum);
+    }
 
-    double nm = vec3_dot(n, m);
-    double nray = vec3_dot(n, ray);
+    c.x *= 0.2 + 0.8 * real_min(sum.x, 1.0);
+    c.y *= 0.2 + 0.8 * real_min(sum.y, 1.0);
+    c.z *= 0.2 + 0.8 * real_min(sum.z, 1.0);
+    return c;
+}
 
-    if (nm * nray < 0.0) {
-        col->depth = - nm / nray;
-        col->color = plane->color;
-        return true;
+/*
+ * [shade] shade pixel (i, j) from what the visibility pass found there
+ *   lux: lux context
+ *   i, j: pixel coordinates
+ *   s: G-buffer sample of the pixel, something was hit
+ * returns the number of shadow rays cast
+ */
+size_t shade(lux_t *lux, size_t i, size_t j, const gsample_t *s)
+{
+    size_t shadow = 0;
+    STATS_CLOCK(t);
+    vec3 c = shade_sample(lux, s, &shadow);
+    STATS_LAP(STATS_SHADE, t);
+
+    ppm_write_at(lux->ppm, i, j, c.x, c.y, c.z);
+    STATS_LAP(STATS_WRITE, t);
+    return shadow;
+}
+
+/*
+ * [make_sample] G-buffer sample of a hit along a primary ray
+ *   lux: lux context
+ *   ray: ray the hit was found on
+ *   hit: nearest hit, job is LUX_NO_HIT if there was none
+ *   g: sample to fill
+ */
+static void make_sample(lux_t *lux, vec3 ray, const hit_t *hit, gsample_t *g)
+{
+    g->edge = false;
+    g->job = hit->job;
+    g->obj = hit->obj;
+    if (hit->job == LUX_NO_HIT)
+        return;
+
+    g->depth = hit->col.depth;
+    g->color = hit->col.color;
+    vec3_mul(ray, hit->col.depth, &g->point);
+    vec3_add(g->point, lux->camera.p, &g->point);
+
+    const job_t *job = &lux->bvh->jobs[hit->job];
+    if (job->normal) {
+        job->normal(job->data + hit->obj * job->obj_size, g->point, &g->normal);
+        if (vec3_dot(g->normal, ray) > 0)
+            vec3_mul(g->normal, -1.0, &g->normal);
+    } else {
+        vec3_mul(ray, -1.0, &g->normal);
     }
+}
 
-    return false;
+/* [store_sample] record the nearest hit along the ray of pixel (i, j) in the G-buffer */
+static void store_sample(lux_t *lux, size_t i, size_t j, vec3 ray, const hit_t *hit)
+{
+    make_sample(lux, ray, hit, gbuffer_at(&lux->gbuffer, i, j));
 }
 
-typedef struct {
-    vec3 color;
-    vec3 u, v;
-    vec3 p;
-    double width;
-} wall_t;
+/*
+ * [visible_pixel] find the nearest object along the ray of pixel (i, j)
+ *   lux: lux context
+ *   w: pointer to pixel depth (float)
+ *   i, j: pixel coordinates
+ *   ray: ray to test for
+ */
+void visible_pixel(lux_t *lux, float *w, size_t i, size_t j, vec3 ray)
+{
+    STATS_CLOCK(t);
+    hit_t hit = { .col.depth = *w, .job = LUX_NO_HIT };
+    if (bvh_nearest(lux->bvh, lux->camera.p, ray, &hit))
+        *w = hit.col.depth;
+    STATS_LAP(STATS_INTERSECT, t);
+
+    store_sample(lux, i, j, ray, &hit);
+}
 
-bool test_ray_wall(vec3 camera, vec3 ray, void *obj, collision_t *col)
+/* [count_rays] add the rays traced for one tile to the frame totals */
+static void count_rays(lux_t *lux, size_t primary, size_t shadow)
 {
-    wall_t *wall = (wall_t*) obj;
+    __atomic_add_fetch(&lux->primary_rays, primary, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&lux->shadow_rays, shadow, __ATOMIC_RELAXED);
+}
 
-    vec3 m;
-    vec3_sub(camera, wall->p, &m);
-    vec3 n;
-    vec3_cross(wall->u, wall->v, &n);
+/*
+ * [visibility_tile] visibility pass over a tile, one ray at a time
+ *   lux: lux context
+ *   tile: pixel block, inside the G-buffer window
+ */
+void visibility_tile(lux_t *lux, tile_t tile)
+{
+    if (lux->order != ORDER_ROWS) {
+        walk_t walk = walk_tile(tile, lux->order);
+        size_t i, j;
+        while (walk_next(&walk, &i, &j)) {
+            STATS_CLOCK(t);
+            vec3 ray = camera_frame_ray(&lux->frame, i, j);
+            STATS_LAP(STATS_RAYGEN, t);
+            visible_pixel(lux, lux_depth_at(lux, i, j), i, j, ray);
+        }
+        return;
+    }
 
-    double nm = vec3_dot(n, m);
-    double nray = vec3_dot(n, ray);
+    vec3 rays[LUX_TILE_SIZE];
 
-    if (nm * nray < 0.0) {
-        col->depth = - nm / nray;
-        col->color = wall->color;
+    for (size_t j = tile.y0; j < tile.y1; j++) {
+        for (size_t i0 = tile.x0; i0 < tile.x1; i0 += LUX_TILE_SIZE) {
+            // generate rays for a run of the scanline at once
+            size_t n = tile.x1 - i0 < LUX_TILE_SIZE ? tile.x1 - i0 : LUX_TILE_SIZE;
+            STATS_CLOCK(t);
+            camera_frame_row(&lux->frame, j, i0, n, rays);
+            STATS_LAP(STATS_RAYGEN, t);
 
-        vec3 pt = ray;
-        vec3_mul(pt, col->depth, &pt);
-        vec3_add(pt, camera, &pt);
-        vec3_sub(pt, wall->p, &pt);
+            for (size_t k = 0; k < n; k++)
+                visible_pixel(lux, lux_depth_at(lux, i0 + k, j), i0 + k, j, rays[k]);
+        }
+    }
+}
 
-        if (fabs(vec3_dot(pt, wall->u)) < wall->width && fabs(vec3_dot(pt, wall->v)) < wall->width)
-            return true;
+/*
+ * [visibility_tile_packets] visibility pass over a tile, tracing primary rays in packets
+ *   lux: lux context
+ *   tile: pixel block, inside the G-buffer window
+ *   edge: packet edge length in pixels
+ */
+void visibility_tile_packets(lux_t *lux, tile_t tile, size_t edge)
+{
+    packet_t p;
+    p.origin = lux->camera.p;
+
+    // packets are walked over like the pixels of a tile of packets
+    tile_t blocks = { 0, 0, (tile.x1 - tile.x0 + edge - 1) / edge, (tile.y1 - tile.y0 + edge - 1) / edge };
+    walk_t walk = walk_tile(blocks, lux->order);
+    size_t bi, bj;
+
+    while (walk_next(&walk, &bi, &bj)) {
+        size_t bx = tile.x0 + bi * edge, by = tile.y0 + bj * edge;
+        size_t w = bx + edge < tile.x1 ? edge : tile.x1 - bx;
+        size_t h = by + edge < tile.y1 ? edge : tile.y1 - by;
+
+        p.n = w * h;
+        STATS_CLOCK(t);
+        for (size_t k = 0; k < p.n; k++) {
+            size_t i = bx + k % w, j = by + k / w;
+            packet_set_ray(&p, k, camera_frame_ray(&lux->frame, i, j));
+            p.hit[k] = (hit_t) { .col.depth = *lux_depth_at(lux, i, j), .job = LUX_NO_HIT };
+        }
+        packet_frustum(&p, w, h);
+        STATS_LAP(STATS_RAYGEN, t);
+
+        bvh_nearest_packet(lux->bvh, &p);
+        STATS_LAP(STATS_INTERSECT, t);
+
+        for (size_t k = 0; k < p.n; k++) {
+            size_t i = bx + k % w, j = by + k / w;
+            if (p.hit[k].job != LUX_NO_HIT)
+                *lux_depth_at(lux, i, j) = p.hit[k].col.depth;
+            store_sample(lux, i, j, (vec3) { p.dx[k], p.dy[k], p.dz[k] }, &p.hit[k]);
+        }
     }
+}
 
-    return false;
+/*
+ * [shade_tile] shading pass over a tile, once per pixel where something was hit
+ *   lux: lux context
+ *   tile: pixel block, through the visibility pass
+ * returns the number of shadow rays cast
+ */
+size_t shade_tile(lux_t *lux, tile_t tile)
+{
+    size_t shadow = 0;
+    walk_t walk = walk_tile(tile, lux->order);
+    size_t i, j;
+    while (walk_next(&walk, &i, &j)) {
+        const gsample_t *g = gbuffer_at(&lux->gbuffer, i, j);
+        if (g->job == LUX_NO_HIT)
+            continue;
+        shadow += shade(lux, i, j, g);
+    }
+    return shadow;
 }
 
+/* rows [y0, y1) of the frame, split into tiles */
 typedef struct {
-    vec3 color;
-    double r;
-    vec3 pos;
-} sphere_t;
+    lux_t *lux;
+    size_t y0, y1;
+    size_t tile_size;
+    size_t tiles_x, tiles_y;
+    /* set by tasks that fail */
+    int err;
+} band_t;
+
+static band_t lux_band(lux_t *lux, size_t y0, size_t y1)
+{
+    size_t ts = lux->tile_size ? lux->tile_size : LUX_TILE_SIZE;
+    return (band_t) {
+        .lux = lux,
+        .y0 = y0, .y1 = y1,
+        .tile_size = ts,
+        .tiles_x = (lux->ppm->width + ts - 1) / ts,
+        .tiles_y = (y1 - y0 + ts - 1) / ts,
+    };
+}
 
-bool test_ray_sphere(vec3 camera, vec3 ray, void *obj, collision_t *col)
+static tile_t band_tile(band_t *band, size_t t)
 {
-    sphere_t *s = (sphere_t*) obj;
-    vec3 m;
-    vec3_sub(camera, s->pos, &m);
+    size_t ts = band->tile_size;
+    size_t tx = t % band->tiles_x;
+    size_t ty = t / band->tiles_x;
+    tile_t tile = {
+        .x0 = tx * ts, .y0 = band->y0 + ty * ts,
+        .x1 = (tx + 1) * ts, .y1 = band->y0 + (ty + 1) * ts,
+    };
+    if (tile.x1 > band->lux->ppm->width) tile.x1 = band->lux->ppm->width;
+    if (tile.y1 > band->y1) tile.y1 = band->y1;
+    return tile;
+}
+
+/* [render_tile] visibility then shading pass over a tile, or its paths; -1 if memory runs out */
+static int render_tile(lux_t *lux, tile_t tile)
+{
+    if (lux->path_samples > 0) {
+        size_t nearest = 0, shadow = 0;
+        if (lux->wavefront && wave_tile(lux, tile, &nearest, &shadow) != 0)
+            return -1;
+        if (!lux->wavefront)
+            nearest = path_tile(lux, tile, &shadow);
+        count_rays(lux, nearest, shadow);
+        return 0;
+    }
 
-    double b = vec3_dot(m, ray);
-    double c = vec3_dot(m, m) - s->r*s->r;
+    size_t edge = lux->packet < PACKET_EDGE_MAX ? lux->packet : PACKET_EDGE_MAX;
+    if (edge > 0)
+        visibility_tile_packets(lux, tile, edge);
+    else
+        visibility_tile(lux, tile);
+    count_rays(lux, (tile.x1 - tile.x0) * (tile.y1 - tile.y0), shade_tile(lux, tile));
+    return 0;
+}
 
-    // Check if interscetion
-    if (c > 0.0 && b > 0.0) return false;
+static void render_tile_task(void *ctx, size_t t, size_t worker)
+{
+    band_t *band = (band_t*) ctx;
+    lux_t *lux = band->lux;
+    tile_t tile = band_tile(band, t);
+    STATS(stats_enter(lux->stats, worker); double start = stats_now());
 
-    float discr = b*b - c;
-    if (discr < 0.0) return false;
+    if (render_tile(lux, tile) != 0)
+        __atomic_store_n(&band->err, -1, __ATOMIC_RELAXED);
 
-    // Calculate intersection
-    float t = -b - sqrt(discr);
-    if (t < 0.0) t = 0.0;
+    STATS(stats_tile(tile, worker, stats_now() - start));
+}
 
-    col->color = s->color;
-    col->depth = t;
+/*
+ * [lux_render_tile] render a single tile on the calling thread, without anti-aliasing
+ *   lux: lux context, committed and with its shadow maps up to date; ppm must
+ *        hold the rows of the tile
+ *   tile: pixel block
+ *
+ * Ray counts are added to lux->primary_rays and lux->shadow_rays.
+ */
+int lux_render_tile(lux_t *lux, tile_t tile)
+{
+    if (camera_frame_setup(&lux->frame, &lux->camera, lux->ppm->width, lux->ppm->height) != 0
+        || gbuffer_setup(&lux->gbuffer, lux->ppm->width, tile.y1 - tile.y0, tile.y0) != 0)
+        return -1;
+    return render_tile(lux, tile);
+}
 
-    return true;
+/* [aa_differs] whether neighbouring samples a and b, shaded ca and cb, are across an edge */
+static inline bool aa_differs(const gsample_t *a, const uint8_t *ca, const gsample_t *b, const uint8_t *cb, real_t threshold)
+{
+    if (a->job != b->job || a->obj != b->obj)
+        return true;
+    if (a->job != LUX_NO_HIT && real_abs(a->depth - b->depth) > threshold * real_min(a->depth, b->depth))
+        return true;
+    for (int c = 0; c < 3; c++) {
+        if (abs(ca[c] - cb[c]) > threshold * 255)
+            return true;
+    }
+    return false;
 }
 
 /*
- * [render_objects] render pixel (i, j) given object array, pixel depth, and ray to test on
- *   lux: lux context
- *   w: pointer to pixel depth (float)
- *   i, j: pixel coordinates
- *   ray: ray to test for
- *   data: pointer to object data array
- *   test: object test function function
- *   obj_size: sizeof object type
- *   obj_n: number of objects in data array
+ * [aa_detect_task] sched_fn marking the pixels of a tile that differ from a
+ * neighbour in object, depth or color; neighbours are only read, so tiles
+ * can be processed in any order
  */
-void render_objects(lux_t *lux, float *w, size_t i, size_t j, vec3 ray, job_t *job)
+static void aa_detect_task(void *ctx, size_t t, size_t worker)
 {
-    collision_t col;
-    for (size_t k = 0; k < job->obj_num; k++) {
-        // test if ray hits object
-        if (job->test(lux->camera.p, ray, job->data + k * job->obj_size, &col) && *w > col.depth) {
-            // ray hits object in this position
-            vec3 source;
-            vec3_mul(ray, col.depth, &source);
-            vec3_add(source, lux->camera.p, &source);
-            *w = col.depth;
-
-            // check if light source hits this
-            vec3 light_ray = lux->light;
-            vec3_sub(light_ray, source, &light_ray);
-            vec3_normalize(light_ray, &light_ray);
-
-            // nudge a bit
-            vec3 lil = light_ray;
-            vec3_mul(lil, 0.001, &lil);
-            vec3_add(source, lil, &source);
-
-            double r, g, b;
-            r = 255.0 * col.color.x;
-            g = 255.0 * col.color.y;
-            b = 255.0 * col.color.z;
-
-            // check if some object obstructs the direct path towards our light source
-            job_t *job2;
-            LL_FOREACH(lux->jobs, job2) {
-                for (size_t s = 0; s < job2->obj_num; s++) {
-                    if (job2->test(source, light_ray, job2->data + s * job2->obj_size, &col)) {
-                        r *= 0.2; g *= 0.2; b *= 0.2;
-                    }
-                }
-            }
-            ppm_write_at(lux->ppm, i, j, r, g, b);
+    (void) worker;
+    band_t *band = (band_t*) ctx;
+    lux_t *lux = band->lux;
+    const gbuffer_t *gb = &lux->gbuffer;
+    const ppm_t *ppm = lux->ppm;
+    size_t width = gb->width;
+    real_t threshold = lux->aa_threshold > 0 ? lux->aa_threshold : LUX_AA_THRESHOLD;
+    tile_t tile = band_tile(band, t);
+
+    for (size_t j = tile.y0; j < tile.y1; j++) {
+        // the gbuffer and the ppm window hold the same rows
+        gsample_t *g = gbuffer_at(gb, tile.x0, j);
+        const uint8_t *c = &ppm->data[3 * ((j - gb->row0) * width + tile.x0)];
+        bool up = j > gb->row0, down = j + 1 < gb->row0 + gb->height;
+
+        for (size_t i = tile.x0; i < tile.x1; i++, g++, c += 3) {
+            g->edge = (i > 0 && aa_differs(g, c, g - 1, c - 3, threshold))
+                || (i + 1 < width && aa_differs(g, c, g + 1, c + 3, threshold))
+                || (up && aa_differs(g, c, g - width, c - 3 * width, threshold))
+                || (down && aa_differs(g, c, g + width, c + 3 * width, threshold));
         }
     }
 }
 
-int lux_render(lux_t *lux)
+/* [aa_offset] per-pixel offset in [0, 1) of the sample pattern, from a hash of the pixel */
+static real_t aa_offset(size_t i, size_t j, uint64_t salt)
+{
+    uint64_t x = ((uint64_t) j << 32 | i) ^ salt;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return (x >> 11) * 0x1.0p-53;
+}
+
+/*
+ * [aa_resolve_task] sched_fn adding up to lux->aa_samples extra samples to
+ * every edge pixel of a tile
+ *
+ * Samples follow the R2 low-discrepancy sequence over the pixel footprint,
+ * shifted by a per-pixel offset, so a given pixel is always sampled at the
+ * same positions whatever the thread count. The first LUX_AA_PROBE samples
+ * decide whether the pixel needs the rest: edge detection marks both sides
+ * of an edge, and pixels that turn out to be covered by a single surface
+ * stop there.
+ */
+static void aa_resolve_task(void *ctx, size_t t, size_t worker)
 {
-    for (size_t j = 0; j < lux->ppm->height; j++) {
-        for (size_t i = 0; i < lux->ppm->width; i++) {
-            // compute ray corresponding to pixel (i, j)
-            vec3 ray = camera_pixel_to_ray(
-                &lux->camera,
-                (double) i / (double) lux->ppm->width,
-                (double) j / (double) lux->ppm->height, 
-                ((double) lux->ppm->width) / lux->ppm->height
-            );
-
-            // render all jobs on this ray
-            job_t *job;
-            LL_FOREACH(lux->jobs, job) {
-                render_objects(lux, &lux->depth[lux->ppm->width * j + i], i, j, ray, job);
+    band_t *band = (band_t*) ctx;
+    lux_t *lux = band->lux;
+    size_t width = lux->ppm->width, height = lux->ppm->height;
+    real_t aspect_ratio = ((real_t) width) / height;
+    real_t threshold = 255 * (lux->aa_threshold > 0 ? lux->aa_threshold : LUX_AA_THRESHOLD);
+    tile_t tile = band_tile(band, t);
+    size_t primary = 0, shadow = 0;
+    STATS(stats_enter(lux->stats, worker));
+
+    walk_t walk = walk_tile(tile, lux->order);
+    size_t i, j;
+    while (walk_next(&walk, &i, &j)) {
+        const gsample_t *center = gbuffer_at(&lux->gbuffer, i, j);
+        if (!center->edge)
+            continue;
+
+        uint8_t c[3];
+        ppm_read_at(lux->ppm, i, j, c);
+        vec3 base = { c[0], c[1], c[2] };
+        vec3 sum = base;
+        real_t u = aa_offset(i, j, 0), v = aa_offset(i, j, 0x9e3779b97f4a7c15ULL);
+        bool uniform = true;
+
+        size_t k;
+        for (k = 0; k < lux->aa_samples && (k < LUX_AA_PROBE || !uniform); k++) {
+            u += 0.7548776662466927;
+            v += 0.5698402909980532;
+            u -= (int) u;
+            v -= (int) v;
+
+            vec3 ray = camera_pixel_to_ray(&lux->camera, (i + u) / width, (j + v) / height, aspect_ratio);
+            hit_t hit = { .col.depth = FLT_MAX, .job = LUX_NO_HIT };
+            bvh_nearest(lux->bvh, lux->camera.p, ray, &hit);
+
+            vec3 color = { 0.0, 0.0, 0.0 };
+            if (hit.job != LUX_NO_HIT) {
+                gsample_t g;
+                make_sample(lux, ray, &hit, &g);
+                color = shade_sample(lux, &g, &shadow);
             }
+            vec3_add(sum, color, &sum);
+
+            uniform = uniform && hit.job == center->job && hit.obj == center->obj
+                && real_abs(color.x - base.x) <= threshold
+                && real_abs(color.y - base.y) <= threshold
+                && real_abs(color.z - base.z) <= threshold;
         }
+        primary += k;
+
+        vec3_mul(sum, 1.0 / (k + 1), &sum);
+        ppm_write_at(lux->ppm, i, j, sum.x, sum.y, sum.z);
     }
 
-    return 0;
+    count_rays(lux, primary, shadow);
 }
 
-void lux_submit_job(lux_t *lux, job_t *job)
+/*
+ * [lux_commit] (re)build the acceleration structures over all submitted jobs and lights
+ *   lux: lux context
+ */
+int lux_commit(lux_t *lux)
 {
-    LL_APPEND(lux->jobs, job);
+    bvh_free(lux->bvh);
+    light_grid_free(&lux->light_grid);
+    lux->bvh = bvh_build(lux->jobs, lux->job_num);
+    if (!lux->bvh || light_grid_build(&lux->light_grid, lux->lights, lux->light_num) != 0)
+        return -1;
+    lux->dirty = false;
+    return 0;
 }
 
-int main(int argc, char **argv)
+/*
+ * [lux_flush_window] write out the rows a streamed image holds and move on to
+ * the next window, whose depths start at FLT_MAX
+ *   lux: lux context
+ */
+int lux_flush_window(lux_t *lux)
 {
-    const size_t WIDTH = 1000;
-    const size_t HEIGHT = WIDTH;
-
-    lux_t lux = {
-        .ppm = ppm_create("out.ppm", WIDTH, HEIGHT),
-        .depth = malloc(sizeof(float) * WIDTH * HEIGHT),
-        .camera = {
-            .p = (vec3) { 1.0, 1.0, -1.0 },
-            .fov = 30.0
-        },
-        .light = { 5.0, 5.0, 0.0 },
-        .jobs = NULL,
-    };
-
-    camera_look_at((vec3) { 0.0, 0.0, 0.0 }, &lux.camera);
-
-    for (size_t i = 0; i < HEIGHT * WIDTH; i++)
-        lux.depth[i] = FLT_MAX;
+    ppm_t *ppm = lux->ppm;
+    if (ppm_flush(ppm) != 0)
+        return -1;
+    for (size_t i = 0; i < ppm->width * ppm->rows; i++)
+        lux->depth[i] = FLT_MAX;
+    return 0;
+}
 
-    sphere_t spheres[3];
-    spheres[0] = (sphere_t) {
-        .r = 0.25,
-        .pos = { -0.5, 0.2, 0.0 },
-        .color = { 1.0, 0.0, 0.0 }
-    };
-    spheres[1] = (sphere_t) {
-        .r = 0.25,
-        .pos = { 0.5, 0.1, 0.0 },
-        .color = { 0.0, 1.0, 0.0 }
-    };
-    spheres[2] = (sphere_t) {
-        .r = 0.25,
-        .pos = { 0.0, 0.0, 0.0 },
-        .color = { 0.0, 0.0, 1.0 }
-    };
+/*
+ * [lux_window_rows] rows of a streamed window whose framebuffer (pixels,
+ * depths, G-buffer and ray tables) fits a memory budget; whole rows of tiles
+ * when possible, 0 if not even one row fits
+ *   width, height: image dimensions
+ *   tile_size: tile edge, 0 for LUX_TILE_SIZE
+ *   budget: bytes
+ */
+size_t lux_window_rows(size_t width, size_t height, size_t tile_size, size_t budget)
+{
+    size_t ts = tile_size ? tile_size : LUX_TILE_SIZE;
+    // camera_frame_t tables and the row formatting buffer of P3 images
+    size_t fixed = sizeof(vec3) * (width + height) + 12 * width;
+    size_t row = width * (3 + sizeof(float) + sizeof(gsample_t));
+    if (budget <= fixed)
+        return 0;
+
+    size_t rows = (budget - fixed) / row;
+    if (rows > ts)
+        rows -= rows % ts;
+    return rows < height ? rows : height;
+}
 
-    plane_t xz = {
-        .p = { 0.0, -0.25, 0.0 },
-        .u = { 1.0, 0.0, 0.0 },
-        .v = { 0.0, 0.0, 1.0 },
-        .color = { 1.0, 0.4, 0.7 }
-    };
+int lux_render(lux_t *lux)
+{
+    if ((lux->dirty || !lux->bvh) && lux_commit(lux) != 0)
+        return -1;
+
+    size_t threads = lux->threads ? lux->threads : sched_default_threads();
+    ppm_t *ppm = lux->ppm;
+
+    if (camera_frame_setup(&lux->frame, &lux->camera, ppm->width, ppm->height) != 0)
+        return -1;
+    lux->primary_rays = lux->shadow_rays = 0;
+    if (lux->shadow_map && shadow_maps_update(lux, threads) != 0)
+        return -1;
+    STATS(lux->stats = stats_begin(lux, threads));
+
+    // streamed images only hold a window of rows: render it, write it out, move on
+    int err = 0;
+    for (;;) {
+        size_t y1 = ppm->row0 + ppm->rows < ppm->height ? ppm->row0 + ppm->rows : ppm->height;
+        band_t band = lux_band(lux, ppm->row0, y1);
+        if ((err = gbuffer_setup(&lux->gbuffer, ppm->width, y1 - ppm->row0, ppm->row0)) != 0)
+            break;
+        size_t tiles = band.tiles_x * band.tiles_y;
+        if ((err = sched_run(threads, tiles, render_tile_task, &band)) != 0 || (err = band.err) != 0)
+            break;
+
+        // adaptive anti-aliasing: find edges over the whole window, then supersample them;
+        // paths are already spread over their pixels
+        if (lux->aa_samples > 0 && lux->path_samples == 0
+            && ((err = sched_run(threads, tiles, aa_detect_task, &band)) != 0
+                || (err = sched_run(threads, tiles, aa_resolve_task, &band)) != 0))
+            break;
+
+        if (!(ppm->flags & PPM_STREAM) || (err = lux_flush_window(lux)) != 0 || ppm->row0 >= ppm->height)
+            break;
+    }
 
-    wall_t yz = {
-        .p = { 0.0, 0.5, 0.0 },
-        .u = { 0.0, 0.0, 1.0 },
-        .v = { 0.0, 1.0, 0.0 },
-        .color = { 0.0, 1.0, 1.0 },
-        .width = 0.25,
-    };
+    STATS(stats_end(lux->stats, lux); lux->stats = NULL);
+    return err;
+}
 
-    job_t *job;
-    
-    job = malloc(sizeof(job_t));
-    job->data = (uint8_t*) &xz;
-    job->test = &test_ray_plane;
-    job->obj_size = sizeof(plane_t);
-    job->obj_num = 1;
-    lux_submit_job(&lux, job);
-
-    job = malloc(sizeof(job_t));
-    job->data = (uint8_t*) spheres;
-    job->test = &test_ray_sphere;
-    job->obj_size = sizeof(sphere_t);
-    job->obj_num = 3;
-    lux_submit_job(&lux, job);
-
-    job = malloc(sizeof(job_t));
-    job->data = (uint8_t*) &yz;
-    job->test = &test_ray_wall;
-    job->obj_size = sizeof(wall_t);
-    job->obj_num = 1;
-    //lux_submit_job(&lux, job);
-    
-    lux_render(&lux);
-
-    job_t *tmp;
-    LL_FOREACH_SAFE(lux.jobs, job, tmp) {
-        free(job);
+/*
+ * [lux_submit_job] add a job to the scene, taking effect at the next commit
+ *   lux: lux context
+ *   job: job to copy into the job table; its objects must outlive lux's use of them
+ */
+int lux_submit_job(lux_t *lux, const job_t *job)
+{
+    if (lux->job_num == lux->job_cap) {
+        // grown by hand: realloc would not keep the table on a cache line boundary
+        size_t cap = lux->job_cap ? 2 * lux->job_cap : 8;
+        size_t bytes = (sizeof(job_t) * cap + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+        job_t *jobs = aligned_alloc(ARENA_ALIGN, bytes);
+        if (!jobs)
+            return -1;
+        if (lux->job_num)
+            memcpy(jobs, lux->jobs, sizeof(job_t) * lux->job_num);
+        free(lux->jobs);
+        lux->jobs = jobs;
+        lux->job_cap = cap;
     }
-    ppm_close(lux.ppm);
-    free(lux.depth);
+    lux->jobs[lux->job_num] = *job;
+    lux->jobs[lux->job_num++].kind = geometry_kind(job->test, job->normal);
+    lux->dirty = true;
+    return 0;
+}
 
+/*
+ * [lux_add_light] add a light to the light list, taking effect at the next commit
+ *   lux: lux context
+ *   light: light to copy
+ */
+int lux_add_light(lux_t *lux, const light_t *light)
+{
+    if (lux->light_num == lux->light_cap) {
+        size_t cap = lux->light_cap ? 2 * lux->light_cap : 8;
+        light_t *lights = realloc(lux->lights, sizeof(light_t) * cap);
+        if (!lights)
+            return -1;
+        lux->lights = lights;
+        lux->light_cap = cap;
+    }
+    lux->lights[lux->light_num++] = *light;
+    lux->dirty = true;
     return 0;
 }
 
+/*
+ * [lux_alloc] cache-aligned storage for scene objects, freed by lux_destroy
+ *   lux: lux context
+ *   size: bytes wanted
+ */
+void *lux_alloc(lux_t *lux, size_t size)
+{
+    return arena_alloc(&lux->arena, size);
+}
+
+void lux_destroy(lux_t *lux)
+{
+    bvh_free(lux->bvh);
+    lux->bvh = NULL;
+    camera_frame_free(&lux->frame);
+    gbuffer_free(&lux->gbuffer);
+    free(lux->jobs);
+    lux->jobs = NULL;
+    lux->job_num = lux->job_cap = 0;
+    arena_free(&lux->arena);
+    shadow_maps_free(lux->shadow_maps);
+    lux->shadow_maps = NULL;
+    free(lux->lights);
+    lux->lights = NULL;
+    lux->light_num = lux->light_cap = 0;
+    light_grid_free(&lux->light_grid);
+}
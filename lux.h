@@ -0,0 +1,199 @@
+#ifndef LUX_H
+#define LUX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "vec3.h"
+#include "camera.h"
+#include "ppm.h"
+#include "gbuffer.h"
+#include "arena.h"
+#include "light.h"
+
+typedef struct {
+    vec3 color;
+    float depth;
+} collision_t;
+
+/* axis-aligned bounding box */
+typedef struct {
+    vec3 min, max;
+} aabb_t;
+
+typedef bool collide(vec3, vec3, void*, collision_t*);
+typedef void bound(void*, aabb_t*);
+typedef void normal_at(void*, vec3, vec3*);
+
+/* built-in primitive type of a job, whose objects are tested and shaded without indirect calls */
+typedef enum {
+    /* user-defined: used through the job's function pointers */
+    JOB_GENERIC,
+    JOB_PLANE,
+    JOB_WALL,
+    JOB_SPHERE,
+    JOB_TRIANGLE,
+} job_kind_t;
+
+/* order pixels are traced in within a tile (see walk.h) */
+typedef enum {
+    ORDER_ROWS,
+    /* Z-order curve */
+    ORDER_MORTON,
+    ORDER_HILBERT,
+} pixel_order_t;
+
+/* a homogeneous array of objects; lux keeps its own copy of submitted jobs */
+typedef struct {
+    uint8_t *data;
+    size_t obj_size;
+    size_t obj_num;
+    collide *test;
+    /* bounding box of one object, NULL for unbounded objects (planes) */
+    bound *bounds;
+    /* unit normal of one object at a point on it, NULL to face the viewer */
+    normal_at *normal;
+    /* derived from test and normal by lux_submit_job */
+    job_kind_t kind;
+} job_t;
+
+/* nearest collision along a ray and the object it belongs to */
+typedef struct {
+    collision_t col;
+    /* index of the job in submission order, LUX_NO_HIT if nothing was hit */
+    uint32_t job;
+    /* index of the object within its job */
+    uint32_t obj;
+} hit_t;
+
+#define LUX_NO_HIT UINT32_MAX
+
+/* [hit_closer] whether col on object obj of job job should replace hit; ties go to submission order */
+static inline bool hit_closer(const hit_t *hit, const collision_t *col, uint32_t job, uint32_t obj)
+{
+    if (hit->job == LUX_NO_HIT)
+        return col->depth < hit->col.depth;
+    if (col->depth != hit->col.depth)
+        return col->depth < hit->col.depth;
+    return job < hit->job || (job == hit->job && obj < hit->obj);
+}
+
+static inline void hit_update(hit_t *hit, const collision_t *col, uint32_t job, uint32_t obj)
+{
+    if (hit_closer(hit, col, job, obj)) {
+        hit->col = *col;
+        hit->job = job;
+        hit->obj = obj;
+    }
+}
+
+struct bvh;
+struct stats;
+struct shadow_maps;
+
+typedef struct {
+    ppm_t *ppm;
+    /* depth of the rows ppm holds, from ppm->row0 on (see lux_depth_at); the
+     * caller fills it with FLT_MAX, rows of the later windows of streamed images
+     * start at FLT_MAX */
+    float *depth;
+    camera_t camera;
+    /* ray generation state for the current camera and resolution */
+    camera_frame_t frame;
+    /* visibility of the rows being rendered */
+    gbuffer_t gbuffer;
+    /* the light of scenes without a light list: reaches everywhere, not tested against surfaces */
+    vec3 light;
+    /* point lights (lux_add_light); when there are any, light is unused */
+    light_t *lights;
+    size_t light_num, light_cap;
+    /* a light is skipped at points where its weight falls below this, 0 picks LUX_LIGHT_CUTOFF */
+    real_t light_cutoff;
+    /* lights by region, rebuilt with the acceleration structure */
+    light_grid_t light_grid;
+    /* edge of the shadow cube map faces looked up instead of tracing shadow
+     * rays (approximate, for previews), 0 traces shadow rays */
+    size_t shadow_map;
+    /* relative depth margin of shadow map lookups, 0 picks LUX_SHADOW_BIAS */
+    real_t shadow_bias;
+    struct shadow_maps *shadow_maps;
+    /* submitted jobs in submission order, one cache-aligned table */
+    job_t *jobs;
+    size_t job_num, job_cap;
+    /* storage of scene objects (lux_alloc), freed all at once by lux_destroy */
+    arena_t arena;
+    /* number of render threads, 0 picks one per core */
+    size_t threads;
+    /* tile edge length in pixels, 0 picks LUX_TILE_SIZE */
+    size_t tile_size;
+    /* order pixels are traced in within a tile, for primary and shadow rays alike */
+    pixel_order_t order;
+    /* edge of primary ray packets (up to PACKET_EDGE_MAX), 0 traces rays one by one */
+    size_t packet;
+    /* extra jittered samples taken in pixels on edges (adaptive anti-aliasing), 0 disables it */
+    size_t aa_samples;
+    /* depth jump (relative) or color difference (0-1) between neighbours that makes
+     * an edge, 0 picks LUX_AA_THRESHOLD */
+    real_t aa_threshold;
+    /* paths traced through every pixel (Monte Carlo path tracing with diffuse
+     * bounces, see path.c), 0 renders direct lighting */
+    size_t path_samples;
+    /* most bounces of a path, 0 picks LUX_PATH_DEPTH */
+    size_t path_depth;
+    /* seed of the random numbers of path tracing */
+    uint64_t seed;
+    /* trace paths in stages over queues of rays (see wavefront.c) rather than
+     * one at a time; same image */
+    bool wavefront;
+    /* acceleration structure over jobs, rebuilt after submissions */
+    struct bvh *bvh;
+    bool dirty;
+    /* rays traced by the last lux_render; path tracing bounces count as primary rays */
+    uint64_t primary_rays, shadow_rays;
+    /* statistics of LUX_STATS builds go here, stderr if NULL */
+    FILE *stats_out;
+    struct stats *stats;
+} lux_t;
+
+#define LUX_TILE_SIZE 32
+#define LUX_AA_THRESHOLD 0.1
+/* extra samples an edge pixel gets before the rest are skipped if they all agree */
+#define LUX_AA_PROBE 2
+#define LUX_LIGHT_CUTOFF (1.0 / 256)
+#define LUX_SHADOW_BIAS 0.01
+#define LUX_PATH_DEPTH 8
+/* bounces a path makes before Russian roulette may end it */
+#define LUX_PATH_ROULETTE 3
+
+/*
+ * A rectangular block of pixels [x0, x1) x [y0, y1). Tiles never overlap, so the
+ * worker rendering a tile is the only writer of its slice of the depth buffer
+ * and of the framebuffer.
+ */
+typedef struct {
+    size_t x0, y0;
+    size_t x1, y1;
+} tile_t;
+
+static inline real_t lux_shadow_bias(const lux_t *lux)
+{
+    return lux->shadow_bias > 0 ? lux->shadow_bias : LUX_SHADOW_BIAS;
+}
+
+/* [lux_depth_at] depth of image pixel (i, j), j within the ppm window */
+static inline float *lux_depth_at(const lux_t *lux, size_t i, size_t j)
+{
+    return &lux->depth[(j - lux->ppm->row0) * lux->ppm->width + i];
+}
+
+int lux_submit_job(lux_t *lux, const job_t *job);
+void *lux_alloc(lux_t *lux, size_t size);
+int lux_add_light(lux_t *lux, const light_t *light);
+int lux_commit(lux_t *lux);
+int lux_render(lux_t *lux);
+int lux_render_tile(lux_t *lux, tile_t tile);
+int lux_flush_window(lux_t *lux);
+size_t lux_window_rows(size_t width, size_t height, size_t tile_size, size_t budget);
+bool lux_occluded(lux_t *lux, vec3 source, vec3 dir, real_t max_t);
+void lux_destroy(lux_t *lux);
+
+#endif
@@ -0,0 +1,352 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <unistd.h>
+#include "lux.h"
+#include "geometry.h"
+#include "sequence.h"
+#include "scene.h"
+#include "dist.h"
+#include "server.h"
+#include "parse.h"
+#include "walk.h"
+
+int main(int argc, char **argv)
+{
+    const size_t WIDTH = 1000;
+    const size_t HEIGHT = WIDTH;
+    size_t width = WIDTH, height = HEIGHT;
+    /* bytes the framebuffer of a single image may take, 0 for no limit */
+    size_t mem_cap = 0;
+    size_t threads = 0;
+    size_t packet = 0;
+    size_t aa_samples = 0;
+    double aa_threshold = 0;
+    size_t shadow_map = 0;
+    size_t path_samples = 0;
+    uint64_t seed = 0;
+    bool wavefront = false;
+    pixel_order_t order = ORDER_ROWS;
+    double shadow_bias = 0;
+    size_t workers = 0;
+    bool distributed = false;
+    char *serve = NULL;
+    char *server = NULL;
+    char *delta_path = NULL;
+    server_request_t req = { 0 };
+    char *out = "out.ppm";
+    int flags = 0;
+    char *path = NULL;
+    char *scene_path = NULL;
+    sequence_t seq = {
+        .frames = 60,
+    };
+
+    int opt;
+    while ((opt = getopt(argc, argv, "t:p:o:bSMA:n:P:a:e:s:m:B:D:U:C:c:r:d:RO:N:Z:QT:")) != -1) {
+        switch (opt) {
+        case 'o':
+            out = optarg;
+            break;
+        case 'b':
+            flags |= PPM_BINARY;
+            break;
+        case 'S':
+            flags |= PPM_STREAM;
+            break;
+        case 'M':
+            flags |= PPM_MMAP;
+            break;
+        case 't':
+            threads = strtoul(optarg, NULL, 10);
+            break;
+        case 'p':
+            packet = strtoul(optarg, NULL, 10);
+            break;
+        case 'a':
+            aa_samples = strtoul(optarg, NULL, 10);
+            break;
+        case 'e':
+            aa_threshold = strtod(optarg, NULL);
+            break;
+        case 's':
+            scene_path = optarg;
+            break;
+        case 'm':
+            shadow_map = strtoul(optarg, NULL, 10);
+            break;
+        case 'B':
+            shadow_bias = strtod(optarg, NULL);
+            break;
+        case 'N':
+            path_samples = strtoul(optarg, NULL, 10);
+            break;
+        case 'Z':
+            seed = strtoull(optarg, NULL, 10);
+            break;
+        case 'Q':
+            wavefront = true;
+            break;
+        case 'T':
+            if (walk_order_parse(optarg, &order) != 0) {
+                fprintf(stderr, "pixel order expected as rows, morton or hilbert\n");
+                return 1;
+            }
+            break;
+        case 'D':
+            workers = strtoul(optarg, NULL, 10);
+            distributed = true;
+            break;
+        case 'U':
+            serve = optarg;
+            break;
+        case 'C':
+            server = optarg;
+            break;
+        case 'c':
+            if (sscanf(optarg, "%lf %lf %lf %lf %lf %lf %lf", &req.pos[0], &req.pos[1], &req.pos[2],
+                       &req.target[0], &req.target[1], &req.target[2], &req.fov) != 7) {
+                fprintf(stderr, "camera expected as \"px py pz tx ty tz fov\"\n");
+                return 1;
+            }
+            req.flags |= SERVER_CAMERA;
+            break;
+        case 'r':
+            if (sscanf(optarg, "%zux%zu", &width, &height) != 2 || !width || !height) {
+                fprintf(stderr, "resolution expected as WIDTHxHEIGHT\n");
+                return 1;
+            }
+            break;
+        case 'd':
+            delta_path = optarg;
+            break;
+        case 'R':
+            req.flags |= SERVER_RESET;
+            break;
+        case 'O':
+            mem_cap = strtoul(optarg, NULL, 10) << 20;
+            break;
+        case 'A':
+            path = optarg;
+            break;
+        case 'n':
+            seq.frames = strtoul(optarg, NULL, 10);
+            break;
+        case 'P':
+            seq.parallel = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-s scene] [-t threads] [-p packet] [-o out.ppm] [-b] [-S] [-M] [-a samples [-e threshold]] [-m shadow_map [-B bias]] [-N paths [-Z seed] [-Q]] [-D workers] [-r WxH] [-O megabytes] [-T rows|morton|hilbert]"
+                    " [-A keyframes [-n frames] [-P parallel]] [-U socket]"
+                    " [-C socket [-c \"px py pz tx ty tz fov\"] [-d delta.scene] [-R]]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    // edge detection needs neighbouring pixels, which other workers may hold
+    if (distributed && aa_samples > 0 && path_samples == 0) {
+        fprintf(stderr, "adaptive anti-aliasing (-a) cannot be used with -D\n");
+        return 1;
+    }
+
+    // client of a render server: nothing to load, the server has the scene
+    if (server) {
+        char *delta = delta_path ? parse_read_file(delta_path) : NULL;
+        if (delta_path && !delta) {
+            fprintf(stderr, "cannot read %s\n", delta_path);
+            return 1;
+        }
+        req.width = width;
+        req.height = height;
+        req.delta_size = delta ? strlen(delta) : 0;
+
+        server_reply_t reply;
+        FILE *f = fopen(out, "wb");
+        int err = !f || server_call(server, &req, delta, f, &reply) != 0;
+        if (f && fclose(f) != 0)
+            err = 1;
+        free(delta);
+        if (err) {
+            fprintf(stderr, "no answer from %s\n", server);
+            return 1;
+        }
+        if (reply.status == SERVER_BAD_DELTA) {
+            fprintf(stderr, "%s:%u: rejected by the server\n", delta_path, reply.error_line);
+            return 1;
+        }
+        if (reply.status != SERVER_OK) {
+            fprintf(stderr, "request refused by %s (status %d)\n", server, reply.status);
+            return 1;
+        }
+        return 0;
+    }
+
+    scene_t scene = { 0 };
+    if (scene_path && scene_load(&scene, scene_path) != 0) {
+        if (scene.error_line)
+            fprintf(stderr, "%s:%zu: syntax error\n", scene_path, scene.error_line);
+        else
+            fprintf(stderr, "cannot read %s\n", scene_path);
+        scene_free(&scene);
+        return 1;
+    }
+
+    if (path) {
+        FILE *f = fopen(path, "r");
+        if (!f || sequence_load(&seq, f) != 0) {
+            fprintf(stderr, "cannot load keyframes from %s\n", path);
+            return 1;
+        }
+        fclose(f);
+        char name[4096];
+        if (sequence_frame_name(out, 0, name, sizeof(name)) < 0) {
+            fprintf(stderr, "%s: output takes one %%d conversion (%%04d pads it) and %%%% at most\n", out);
+            return 1;
+        }
+        seq.out = out;
+        seq.width = width;
+        seq.height = height;
+        seq.flags = flags;
+    }
+
+    // out of core: stream windows of rows small enough for the cap to the file
+    size_t window = 0;
+    if (mem_cap) {
+        flags = (flags | PPM_STREAM) & ~PPM_MMAP;
+        if (!(window = lux_window_rows(width, height, 0, mem_cap))) {
+            fprintf(stderr, "a %zu MB framebuffer cannot hold a row of %zu pixels\n", mem_cap >> 20, width);
+            return 1;
+        }
+    }
+
+    // sequences and the server allocate their own images
+    bool own_image = !path && !serve;
+    ppm_t *ppm = own_image ? ppm_open(out, width, height, flags, window) : NULL;
+    lux_t lux = {
+        .ppm = ppm,
+        .depth = ppm ? malloc(sizeof(float) * width * ppm->rows) : NULL,
+        .camera = {
+            .p = (vec3) { 1.0, 1.0, -1.0 },
+            .fov = 30.0
+        },
+        .light = { 5.0, 5.0, 0.0 },
+        .threads = threads,
+        .packet = packet,
+        .aa_samples = aa_samples,
+        .aa_threshold = aa_threshold,
+        .shadow_map = shadow_map,
+        .shadow_bias = shadow_bias,
+        .path_samples = path_samples,
+        .seed = seed,
+        .wavefront = wavefront,
+        .order = order,
+    };
+
+    if (own_image && !lux.ppm) {
+        fprintf(stderr, "cannot open %s\n", out);
+        return 1;
+    }
+    if (lux.ppm && !lux.depth) {
+        fprintf(stderr, "cannot allocate a depth buffer of %zu rows\n", lux.ppm->rows);
+        ppm_close(lux.ppm);
+        return 1;
+    }
+
+    camera_look_at((vec3) { 0.0, 0.0, 0.0 }, &lux.camera);
+
+    for (size_t i = 0; lux.depth && i < width * ppm->rows; i++)
+        lux.depth[i] = FLT_MAX;
+
+    sphere_t spheres[3];
+    spheres[0] = (sphere_t) {
+        .r = 0.25,
+        .pos = { -0.5, 0.2, 0.0 },
+        .color = { 1.0, 0.0, 0.0 }
+    };
+    spheres[1] = (sphere_t) {
+        .r = 0.25,
+        .pos = { 0.5, 0.1, 0.0 },
+        .color = { 0.0, 1.0, 0.0 }
+    };
+    spheres[2] = (sphere_t) {
+        .r = 0.25,
+        .pos = { 0.0, 0.0, 0.0 },
+        .color = { 0.0, 0.0, 1.0 }
+    };
+
+    plane_t xz = {
+        .p = { 0.0, -0.25, 0.0 },
+        .u = { 1.0, 0.0, 0.0 },
+        .v = { 0.0, 0.0, 1.0 },
+        .color = { 1.0, 0.4, 0.7 }
+    };
+
+    wall_t yz = {
+        .p = { 0.0, 0.5, 0.0 },
+        .u = { 0.0, 0.0, 1.0 },
+        .v = { 0.0, 1.0, 0.0 },
+        .color = { 0.0, 1.0, 1.0 },
+        .width = 0.25,
+    };
+
+    job_t job;
+    
+    if (scene_path) {
+        if (scene_submit(&scene, &lux) != 0) {
+            fprintf(stderr, "cannot submit %s\n", scene_path);
+            return 1;
+        }
+    } else {
+        job.data = (uint8_t*) &xz;
+        job.test = &test_ray_plane;
+        job.normal = &normal_plane;
+        job.bounds = NULL;
+        job.obj_size = sizeof(plane_t);
+        job.obj_num = 1;
+        lux_submit_job(&lux, &job);
+
+        job.data = (uint8_t*) spheres;
+        job.test = &test_ray_sphere;
+        job.normal = &normal_sphere;
+        job.bounds = &bound_sphere;
+        job.obj_size = sizeof(sphere_t);
+        job.obj_num = 3;
+        lux_submit_job(&lux, &job);
+
+        job.data = (uint8_t*) &yz;
+        job.test = &test_ray_wall;
+        job.normal = &normal_wall;
+        job.bounds = &bound_wall;
+        job.obj_size = sizeof(wall_t);
+        job.obj_num = 1;
+        //lux_submit_job(&lux, &job);
+    }
+    
+    int err = 0;
+    if (path) {
+        if ((err = lux_render_sequence(&lux, &seq)) != 0)
+            fprintf(stderr, "cannot render the sequence to %s\n", out);
+        free(seq.keys);
+    } else if (serve) {
+        if ((err = lux_serve(&lux, serve)) != 0)
+            fprintf(stderr, "cannot serve on %s\n", serve);
+    } else if (distributed) {
+        if ((err = lux_render_distributed(&lux, workers)) != 0)
+            fprintf(stderr, "distributed render failed\n");
+    } else {
+        if ((err = lux_render(&lux)) != 0)
+            fprintf(stderr, "cannot render to %s\n", out);
+    }
+
+    scene_free(&scene);
+    lux_destroy(&lux);
+    if (lux.ppm && ppm_close(lux.ppm) != 0 && !err) {
+        fprintf(stderr, "cannot write %s\n", out);
+        err = -1;
+    }
+    free(lux.depth);
+
+    return err ? 1 : 0;
+}
+
@@ -0,0 +1,116 @@
+#include "mesh.h"
+#include <stdlib.h>
+#include <string.h>
+#include "parse.h"
+
+/*
+ * [mesh_load_obj] read the geometry of a Wavefront OBJ file
+ *   mesh: mesh to fill; its triangles point back to it, so it must not move
+ *         afterwards. Its vertex and triangle arrays come from malloc and
+ *         belong to the caller, even on failure (scene_parse moves them to
+ *         the scene's arena).
+ *   path: OBJ file
+ *
+ * Only v and f statements are used: faces may carry texture and normal
+ * indices (v/vt/vn), which are skipped, negative (relative) indices are
+ * resolved, and polygons are split into a fan of triangles. The color is
+ * left white.
+ */
+int mesh_load_obj(mesh_t *mesh, const char *path)
+{
+    memset(mesh, 0, sizeof(mesh_t));
+    mesh->color = (vec3) { 1.0, 1.0, 1.0 };
+
+    char *buf = parse_read_file(path);
+    if (!buf)
+        return -1;
+
+    size_t vcap = 0, tcap = 0;
+    const char *at = buf;
+    int err = 0;
+
+    while (*at && !err) {
+        while (*at == ' ' || *at == '\t')
+            at++;
+
+        if (at[0] == 'v' && (at[1] == ' ' || at[1] == '\t')) {
+            at++;
+            double v[3];
+            vec3 *vertices = parse_grow(mesh->vertices, mesh->vertex_num, &vcap, sizeof(vec3));
+            if (!vertices || !parse_real(&at, &v[0]) || !parse_real(&at, &v[1]) || !parse_real(&at, &v[2])) {
+                err = -1;
+                break;
+            }
+            mesh->vertices = vertices;
+            mesh->vertices[mesh->vertex_num++] = (vec3) { v[0], v[1], v[2] };
+        } else if (at[0] == 'f' && (at[1] == ' ' || at[1] == '\t')) {
+            at++;
+            long idx;
+            uint32_t corner[3];
+            size_t n = 0;
+            while (!err && parse_int(&at, &idx)) {
+                // skip the texture and normal indices of the corner
+                while (*at == '/' || *at == '-' || (*at >= '0' && *at <= '9'))
+                    at++;
+
+                long v = idx < 0 ? (long) mesh->vertex_num + idx : idx - 1;
+                if (idx == 0 || v < 0 || v > UINT32_MAX) {
+                    err = -1;
+                    break;
+                }
+                corner[n < 2 ? n : 2] = v;
+
+                // fan: (first, previous, current) for every corner past the second
+                if (++n >= 3) {
+                    triangle_t *tris = parse_grow(mesh->triangles, mesh->triangle_num, &tcap, sizeof(triangle_t));
+                    if (!tris) {
+                        err = -1;
+                        break;
+                    }
+                    mesh->triangles = tris;
+                    mesh->triangles[mesh->triangle_num++] = (triangle_t) {
+                        .mesh = mesh, .v = { corner[0], corner[1], corner[2] },
+                    };
+                    corner[1] = corner[2];
+                }
+            }
+            if (n < 3)
+                err = -1;
+        }
+
+        // the rest of the line (other statements, comments) is ignored
+        while (*at && *at != '\n')
+            at++;
+        if (*at)
+            at++;
+    }
+    free(buf);
+
+    for (size_t k = 0; k < mesh->triangle_num && !err; k++) {
+        for (int c = 0; c < 3; c++) {
+            if (mesh->triangles[k].v[c] >= mesh->vertex_num)
+                err = -1;
+        }
+    }
+    return err;
+}
+
+/* [mesh_transform] scale a mesh about the origin, then move it by offset */
+void mesh_transform(mesh_t *mesh, vec3 offset, real_t scale)
+{
+    for (size_t k = 0; k < mesh->vertex_num; k++) {
+        vec3_mul(mesh->vertices[k], scale, &mesh->vertices[k]);
+        vec3_add(mesh->vertices[k], offset, &mesh->vertices[k]);
+    }
+}
+
+/* [mesh_job] describe a mesh as a job, one object per triangle */
+void mesh_job(mesh_t *mesh, job_t *job)
+{
+    job->data = (uint8_t*) mesh->triangles;
+    job->obj_size = sizeof(triangle_t);
+    job->obj_num = mesh->triangle_num;
+    job->test = &test_ray_triangle;
+    job->bounds = &bound_triangle;
+    job->normal = &normal_triangle;
+}
@@ -0,0 +1,11 @@
+#ifndef MESH_H
+#define MESH_H
+
+#include "lux.h"
+#include "geometry.h"
+
+int mesh_load_obj(mesh_t *mesh, const char *path);
+void mesh_transform(mesh_t *mesh, vec3 offset, real_t scale);
+void mesh_job(mesh_t *mesh, job_t *job);
+
+#endif
@@ -0,0 +1,179 @@
+#include "packet.h"
+#include <math.h>
+#include "stats.h"
+
+/*
+ * Packet versions of the object tests in geometry.c. All rays of a packet
+ * share their origin, so everything that only depends on the origin and the
+ * object is computed once per packet; the per-ray arithmetic is the one of
+ * the single-ray tests, which keeps both paths bit-identical.
+ */
+
+void packet_set_ray(packet_t *p, size_t k, vec3 ray)
+{
+    p->dx[k] = ray.x;
+    p->dy[k] = ray.y;
+    p->dz[k] = ray.z;
+}
+
+static inline vec3 packet_ray(const packet_t *p, size_t k)
+{
+    return (vec3) { p->dx[k], p->dy[k], p->dz[k] };
+}
+
+/*
+ * [packet_frustum] compute the side planes of a packet from its corner rays
+ *   p: packet, rays already set
+ *   width, height: dimensions of the pixel block, width * height == p->n
+ */
+void packet_frustum(packet_t *p, size_t width, size_t height)
+{
+    vec3 corner[4] = {
+        packet_ray(p, 0),
+        packet_ray(p, width - 1),
+        packet_ray(p, p->n - 1),
+        packet_ray(p, (height - 1) * width),
+    };
+    vec3 center = { 0.0, 0.0, 0.0 };
+    for (int k = 0; k < 4; k++)
+        vec3_add(center, corner[k], &center);
+
+    for (int k = 0; k < 4; k++) {
+        vec3 n;
+        vec3_cross(corner[k], corner[(k + 1) % 4], &n);
+        real_t len = vec3_norm(n);
+        if (len == 0.0) {
+            // degenerate block (one row or column): this plane never rejects
+            p->planes[k] = n;
+            continue;
+        }
+        vec3_mul(n, (vec3_dot(n, center) < 0.0 ? -1.0 : 1.0) / len, &p->planes[k]);
+    }
+}
+
+/* tolerance for rays grazing a frustum plane because of rounding */
+static inline real_t reject_margin(vec3 d)
+{
+    return 1e-9 * (1.0 + real_abs(d.x) + real_abs(d.y) + real_abs(d.z));
+}
+
+/* [packet_reject_box] whether a box lies entirely outside the frustum of a packet */
+bool packet_reject_box(const packet_t *p, const aabb_t *box)
+{
+    for (int k = 0; k < 4; k++) {
+        vec3 n = p->planes[k];
+        // corner of the box furthest along the plane normal
+        vec3 far = {
+            n.x > 0.0 ? box->max.x : box->min.x,
+            n.y > 0.0 ? box->max.y : box->min.y,
+            n.z > 0.0 ? box->max.z : box->min.z,
+        };
+        vec3_sub(far, p->origin, &far);
+        if (vec3_dot(n, far) < -reject_margin(far))
+            return true;
+    }
+    return false;
+}
+
+/* [packet_reject_sphere] whether a sphere lies entirely outside the frustum of a packet */
+bool packet_reject_sphere(const packet_t *p, vec3 pos, real_t r)
+{
+    vec3 m;
+    vec3_sub(pos, p->origin, &m);
+    for (int k = 0; k < 4; k++) {
+        if (vec3_dot(p->planes[k], m) < -r - reject_margin(m))
+            return true;
+    }
+    return false;
+}
+
+/*
+ * [packet_sphere] test rays [first, n) of a packet against one sphere
+ *   p: packet
+ *   first: first ray that may hit
+ *   pos, r, color: sphere
+ *   job, obj: object the sphere is, for hit ordering
+ */
+void packet_sphere(packet_t *p, size_t first, vec3 pos, real_t r, vec3 color, uint32_t job, uint32_t obj)
+{
+    vec3 m;
+    vec3_sub(p->origin, pos, &m);
+    real_t c = vec3_dot(m, m) - r*r;
+
+    STATS_TEST(job, p->n - first);
+    for (size_t k = first; k < p->n; k++) {
+        real_t b = m.x * p->dx[k] + m.y * p->dy[k] + m.z * p->dz[k];
+
+        if (c > 0.0 && b > 0.0) continue;
+
+        float discr = b*b - c;
+        if (discr < 0.0) continue;
+
+        float t = -b - real_sqrt(discr);
+        if (t < 0.0) t = 0.0;
+
+        collision_t col = { .color = color, .depth = t };
+        STATS_HIT(job);
+        hit_update(&p->hit[k], &col, job, obj);
+    }
+}
+
+void packet_plane(packet_t *p, size_t first, const plane_t *plane, uint32_t job, uint32_t obj)
+{
+    vec3 m, n;
+    vec3_sub(p->origin, plane->p, &m);
+    vec3_cross(plane->u, plane->v, &n);
+    real_t nm = vec3_dot(n, m);
+
+    STATS_TEST(job, p->n - first);
+    for (size_t k = first; k < p->n; k++) {
+        real_t nray = n.x * p->dx[k] + n.y * p->dy[k] + n.z * p->dz[k];
+        if (nm * nray < 0.0) {
+            collision_t col = { .color = plane->color, .depth = - nm / nray };
+            STATS_HIT(job);
+            hit_update(&p->hit[k], &col, job, obj);
+        }
+    }
+}
+
+void packet_wall(packet_t *p, size_t first, const wall_t *wall, uint32_t job, uint32_t obj)
+{
+    vec3 m, n;
+    vec3_sub(p->origin, wall->p, &m);
+    vec3_cross(wall->u, wall->v, &n);
+    real_t nm = vec3_dot(n, m);
+
+    STATS_TEST(job, p->n - first);
+    for (size_t k = first; k < p->n; k++) {
+        real_t nray = n.x * p->dx[k] + n.y * p->dy[k] + n.z * p->dz[k];
+        if (nm * nray >= 0.0)
+            continue;
+
+        collision_t col = { .color = wall->color, .depth = - nm / nray };
+
+        vec3 pt = packet_ray(p, k);
+        vec3_mul(pt, col.depth, &pt);
+        vec3_add(pt, p->origin, &pt);
+        vec3_sub(pt, wall->p, &pt);
+
+        if (real_abs(vec3_dot(pt, wall->u)) < wall->width && real_abs(vec3_dot(pt, wall->v)) < wall->width) {
+            STATS_HIT(job);
+            hit_update(&p->hit[k], &col, job, obj);
+        }
+    }
+}
+
+/* [packet_generic] test rays through the job's own test function, for user-defined objects */
+void packet_generic(packet_t *p, size_t first, const job_t *job, uint32_t j, uint32_t obj)
+{
+    void *data = job->data + obj * job->obj_size;
+    collision_t col;
+
+    STATS_TEST(j, p->n - first);
+    for (size_t k = first; k < p->n; k++) {
+        if (job->test(p->origin, packet_ray(p, k), data, &col)) {
+            STATS_HIT(j);
+            hit_update(&p->hit[k], &col, j, obj);
+        }
+    }
+}
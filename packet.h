@@ -0,0 +1,36 @@
+#ifndef PACKET_H
+#define PACKET_H
+
+#include "lux.h"
+#include "geometry.h"
+
+/* largest packet edge, in pixels */
+#define PACKET_EDGE_MAX 8
+#define PACKET_MAX (PACKET_EDGE_MAX * PACKET_EDGE_MAX)
+
+/*
+ * A block of coherent rays sharing one origin, stored as structure of arrays,
+ * along with the frustum bounding them. Rays are in row-major order within
+ * the block.
+ */
+typedef struct {
+    size_t n;
+    vec3 origin;
+    real_t dx[PACKET_MAX], dy[PACKET_MAX], dz[PACKET_MAX];
+    /* nearest hit of every ray, seeded by the caller */
+    hit_t hit[PACKET_MAX];
+    /* inward-facing unit normals of the four side planes, all through origin */
+    vec3 planes[4];
+} packet_t;
+
+void packet_set_ray(packet_t *p, size_t k, vec3 ray);
+void packet_frustum(packet_t *p, size_t width, size_t height);
+bool packet_reject_box(const packet_t *p, const aabb_t *box);
+bool packet_reject_sphere(const packet_t *p, vec3 pos, real_t r);
+
+void packet_sphere(packet_t *p, size_t first, vec3 pos, real_t r, vec3 color, uint32_t job, uint32_t obj);
+void packet_plane(packet_t *p, size_t first, const plane_t *plane, uint32_t job, uint32_t obj);
+void packet_wall(packet_t *p, size_t first, const wall_t *wall, uint32_t job, uint32_t obj);
+void packet_generic(packet_t *p, size_t first, const job_t *job, uint32_t j, uint32_t obj);
+
+#endif
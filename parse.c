@@ -0,0 +1,137 @@
+#include "parse.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+/*
+ * Helpers shared by the text loaders (scene files, OBJ meshes): files are read
+ * whole and numbers parsed in place with a cursor.
+ */
+
+/* [parse_read_file] whole contents of a file, NUL terminated, NULL on failure */
+char *parse_read_file(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return NULL;
+
+    char *buf = NULL;
+    long size;
+    if (fseek(f, 0, SEEK_END) == 0 && (size = ftell(f)) >= 0 && fseek(f, 0, SEEK_SET) == 0
+        && (buf = malloc(size + 1))) {
+        if (fread(buf, 1, size, f) == (size_t) size) {
+            buf[size] = '\0';
+        } else {
+            free(buf);
+            buf = NULL;
+        }
+    }
+    fclose(f);
+    return buf;
+}
+
+/*
+ * [parse_grow] make room for one more element in an array doubling its
+ * capacity; returns the array, possibly moved, or NULL (the array is left
+ * as it was) if memory runs out
+ *   array: array holding num elements of size bytes, NULL while empty
+ *   cap: its capacity, updated
+ */
+void *parse_grow(void *array, size_t num, size_t *cap, size_t size)
+{
+    if (num < *cap)
+        return array;
+    size_t n = *cap ? 2 * *cap : 1024;
+    void *res = realloc(array, n * size);
+    if (res)
+        *cap = n;
+    return res;
+}
+
+/* powers of ten that are exact in a double */
+static const double exact_pow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+/*
+ * [parse_real] read a decimal number after optional blanks
+ *   at: cursor, moved past the number on success
+ *   v: result
+ *
+ * Plain decimals of up to 15 significant digits are an exact integer over an
+ * exact power of ten, so one division rounds them correctly, as strtod would.
+ * Exponents and longer numbers are left to strtod.
+ */
+bool parse_real(const char **at, double *v)
+{
+    const char *p = *at;
+    while (*p == ' ' || *p == '\t')
+        p++;
+    const char *start = p;
+
+    bool neg = *p == '-';
+    if (*p == '-' || *p == '+')
+        p++;
+
+    uint64_t m = 0;
+    int digits = 0, decimals = 0;
+    bool any = false, dot = false;
+    for (;; p++) {
+        if (*p == '.' && !dot) {
+            dot = true;
+            continue;
+        }
+        if (*p < '0' || *p > '9')
+            break;
+        any = true;
+        m = m * 10 + (*p - '0');
+        digits += m != 0;
+        decimals += dot;
+    }
+    if (!any)
+        return false;
+
+    if (*p == 'e' || *p == 'E' || digits > 15 || decimals > 22) {
+        char *end;
+        *v = strtod(start, &end);
+        if (end == start)
+            return false;
+        p = end;
+    } else {
+        *v = (neg ? -1.0 : 1.0) * ((double) m / exact_pow10[decimals]);
+    }
+
+    // numbers end at a blank, a comment or the end of the line
+    if (*p && !strchr(" \t\r\n#", *p))
+        return false;
+    *at = p;
+    return true;
+}
+
+/*
+ * [parse_int] read a decimal integer after optional blanks
+ *   at: cursor, moved past the number on success
+ *   v: result
+ */
+bool parse_int(const char **at, long *v)
+{
+    const char *p = *at;
+    while (*p == ' ' || *p == '\t')
+        p++;
+
+    bool neg = *p == '-';
+    if (*p == '-' || *p == '+')
+        p++;
+    if (*p < '0' || *p > '9')
+        return false;
+
+    long n = 0;
+    for (; *p >= '0' && *p <= '9'; p++)
+        n = n * 10 + (*p - '0');
+
+    *v = neg ? -n : n;
+    *at = p;
+    return true;
+}
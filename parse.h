@@ -0,0 +1,12 @@
+#ifndef PARSE_H
+#define PARSE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+char *parse_read_file(const char *path);
+void *parse_grow(void *array, size_t num, size_t *cap, size_t size);
+bool parse_real(const char **at, double *v);
+bool parse_int(const char **at, long *v);
+
+#endif
@@ -0,0 +1,172 @@
+#include "path.h"
+#include <float.h>
+#include "bvh.h"
+#include "shadowmap.h"
+#include "walk.h"
+
+/*
+ * Monte Carlo path tracing: every surface is a diffuse reflector of its
+ * color. A path starts with a jittered ray through the pixel, and at each
+ * surface it hits gathers the light arriving straight from the light sources
+ * (next event estimation: one shadow ray per light, or a shadow map lookup),
+ * then bounces in a cosine-distributed direction. The cosine distribution
+ * cancels the cosine and the 1 / pi of the diffuse reflection, so a bounce
+ * only scales the path's throughput by the surface color. Past
+ * LUX_PATH_ROULETTE bounces paths are ended at random (Russian roulette) with
+ * the probability of their throughput being lost, and survivors are weighted
+ * up to keep the estimate unbiased.
+ *
+ * Lights are those of direct lighting, weighted by the cosine of their
+ * incidence: the light list with its falloff, or the scene light at full
+ * strength. Nothing comes from the background.
+ *
+ * Each path draws from its own random stream, seeded from lux->seed, the
+ * pixel and the path's number within it (path_stream), so an image only
+ * depends on the seed, never on the thread count, the order tiles are
+ * rendered in or the order paths are traced in (see wavefront.c).
+ */
+
+/* [path_blocked] whether anything stands between surface point p and target */
+static bool path_blocked(lux_t *lux, vec3 p, vec3 target)
+{
+    vec3 source, dir;
+    real_t max_t = path_shadow_ray(p, target, &source, &dir);
+    return lux_occluded(lux, source, dir, max_t);
+}
+
+/*
+ * [path_direct] light arriving at a surface point straight from the lights,
+ * cosine weighted
+ *   lux: lux context
+ *   p: point
+ *   n: unit normal at p, on the side the path comes from
+ *   shadow: incremented by the number of shadow rays cast
+ */
+static vec3 path_direct(lux_t *lux, vec3 p, vec3 n, size_t *shadow)
+{
+    vec3 sum = { 0.0, 0.0, 0.0 };
+
+    if (lux->light_num == 0) {
+        real_t cos = path_scene_light(lux, p, n);
+        if (cos <= 0.0)
+            return sum;
+
+        real_t vis;
+        if (lux->shadow_map) {
+            vis = shadow_map_visibility(lux->shadow_maps, 0, p, n, lux_shadow_bias(lux));
+        } else {
+            vis = !path_blocked(lux, p, lux->light);
+            (*shadow)++;
+        }
+        return (vec3) { cos * vis, cos * vis, cos * vis };
+    }
+
+    real_t cutoff = lux->light_cutoff > 0 ? lux->light_cutoff : LUX_LIGHT_CUTOFF;
+    const light_grid_t *grid = &lux->light_grid;
+    const uint32_t *near = NULL;
+    size_t near_num = light_grid_cell(grid, p, &near);
+
+    for (size_t k = 0; k < grid->unbounded_num + near_num; k++) {
+        uint32_t l = k < grid->unbounded_num ? grid->unbounded[k] : near[k - grid->unbounded_num];
+        const light_t *light = &lux->lights[l];
+        real_t w = path_light(light, p, n, cutoff);
+        if (w == 0.0)
+            continue;
+
+        if (lux->shadow_map) {
+            w *= shadow_map_visibility(lux->shadow_maps, l, p, n, lux_shadow_bias(lux));
+        } else {
+            (*shadow)++;
+            if (path_blocked(lux, p, light->pos))
+                continue;
+        }
+
+        vec3 c;
+        vec3_mul(light->color, w, &c);
+        vec3_add(sum, c, &sum);
+    }
+    return sum;
+}
+
+/*
+ * [path_trace] light carried back along a path
+ *   lux: lux context
+ *   rng: random stream of the path
+ *   origin, ray: primary ray
+ *   depth: in: how far the primary ray may go; out: how far it went
+ *   nearest: incremented by the number of nearest-hit rays traced
+ *   shadow: incremented by the number of shadow rays cast
+ */
+static vec3 path_trace(lux_t *lux, rng_t *rng, vec3 origin, vec3 ray, float *depth, size_t *nearest, size_t *shadow)
+{
+    size_t max_depth = lux->path_depth ? lux->path_depth : LUX_PATH_DEPTH;
+    vec3 sum = { 0.0, 0.0, 0.0 };
+    vec3 throughput = { 1.0, 1.0, 1.0 };
+
+    for (size_t bounce = 0; bounce <= max_depth; bounce++) {
+        hit_t hit = { .col.depth = bounce ? FLT_MAX : *depth, .job = LUX_NO_HIT };
+        (*nearest)++;
+        if (!bvh_nearest(lux->bvh, origin, ray, &hit))
+            break;
+        if (bounce == 0)
+            *depth = hit.col.depth;
+
+        vec3 p, n;
+        const job_t *job = &lux->bvh->jobs[hit.job];
+        path_surface(job->kind, job, &hit, origin, ray, &p, &n);
+
+        vec3 albedo = hit.col.color;
+        throughput.x *= albedo.x;
+        throughput.y *= albedo.y;
+        throughput.z *= albedo.z;
+
+        vec3 direct = path_direct(lux, p, n, shadow);
+        sum.x += throughput.x * direct.x;
+        sum.y += throughput.y * direct.y;
+        sum.z += throughput.z * direct.z;
+
+        if (bounce == max_depth || (bounce >= LUX_PATH_ROULETTE && !path_roulette(rng, &throughput)))
+            break;
+
+        // leave from just above the surface
+        ray = path_bounce(rng, n);
+        vec3_mul(n, 0.001, &origin);
+        vec3_add(p, origin, &origin);
+    }
+    return sum;
+}
+
+/*
+ * [path_tile] path trace lux->path_samples paths through every pixel of a tile
+ *   lux: lux context, committed and with its shadow maps up to date
+ *   tile: pixel block, inside the ppm window
+ *   shadow: incremented by the number of shadow rays cast
+ * returns the number of nearest-hit rays traced
+ */
+size_t path_tile(lux_t *lux, tile_t tile, size_t *shadow)
+{
+    size_t nearest = 0;
+    walk_t walk = walk_tile(tile, lux->order);
+    size_t i, j;
+
+    while (walk_next(&walk, &i, &j)) {
+        // every path is clipped by the depth the pixel started with, which ends up the nearest hit
+        float *depth = lux_depth_at(lux, i, j);
+        float clip = *depth;
+        vec3 sum = { 0.0, 0.0, 0.0 };
+
+        for (size_t k = 0; k < lux->path_samples; k++) {
+            rng_t rng;
+            rng_seed(&rng, lux->seed, path_stream(lux, i, j, k));
+            vec3 ray = path_primary(lux, &rng, i, j);
+            float d = clip;
+            vec3 c = path_trace(lux, &rng, lux->camera.p, ray, &d, &nearest, shadow);
+            vec3_add(sum, c, &sum);
+            if (d < *depth)
+                *depth = d;
+        }
+
+        path_write(lux, i, j, sum);
+    }
+    return nearest;
+}
@@ -0,0 +1,127 @@
+#ifndef PATH_H
+#define PATH_H
+
+#include <math.h>
+#include "lux.h"
+#include "rng.h"
+#include "geometry.h"
+
+/*
+ * Steps of a path, shared by the tracer running paths one at a time
+ * (path.c) and the wavefront one (wavefront.c): both do the same arithmetic
+ * in the same order and render the same image.
+ */
+
+/* [path_stream] random stream of path k through pixel (i, j) */
+static inline uint64_t path_stream(const lux_t *lux, size_t i, size_t j, size_t k)
+{
+    return ((uint64_t) j * lux->ppm->width + i) * lux->path_samples + k;
+}
+
+/* [path_primary] jittered camera ray of a path through pixel (i, j) */
+static inline vec3 path_primary(lux_t *lux, rng_t *rng, size_t i, size_t j)
+{
+    size_t width = lux->ppm->width, height = lux->ppm->height;
+    real_t u = rng_real(rng), v = rng_real(rng);
+    return camera_pixel_to_ray(&lux->camera, (i + u) / width, (j + v) / height, ((real_t) width) / height);
+}
+
+/*
+ * [path_surface] point and unit normal, facing the ray, of a hit on a job
+ * of type kind; always inlined, with a constant kind normals are computed
+ * without indirect calls
+ */
+static inline __attribute__((always_inline))
+void path_surface(job_kind_t kind, const job_t *job, const hit_t *hit, vec3 origin, vec3 ray, vec3 *p, vec3 *n)
+{
+    vec3_mul(ray, hit->col.depth, p);
+    vec3_add(*p, origin, p);
+    if (kind == JOB_GENERIC && !job->normal) {
+        vec3_mul(ray, -1.0, n);
+        return;
+    }
+    normal_object(kind, job, job->data + hit->obj * job->obj_size, *p, n);
+    if (vec3_dot(*n, ray) > 0)
+        vec3_mul(*n, -1.0, n);
+}
+
+/* [path_scene_light] cosine of the scene light at surface point p of unit normal n, <= 0 when behind */
+static inline real_t path_scene_light(const lux_t *lux, vec3 p, vec3 n)
+{
+    vec3 to_light;
+    vec3_sub(lux->light, p, &to_light);
+    return vec3_dot(to_light, n) / vec3_norm(to_light);
+}
+
+/*
+ * [path_light] weight of a light of the list at surface point p of unit
+ * normal n, falloff and cosine included; 0 when it is out of reach, too faint
+ * or behind
+ */
+static inline real_t path_light(const light_t *light, vec3 p, vec3 n, real_t cutoff)
+{
+    vec3 to_light;
+    vec3_sub(light->pos, p, &to_light);
+    real_t d2 = vec3_dot(to_light, to_light);
+    real_t w = light_falloff(light, d2);
+    real_t cos = vec3_dot(to_light, n);
+    if (w * real_max(light->color.x, real_max(light->color.y, light->color.z)) < cutoff || cos <= 0.0)
+        return 0.0;
+    return w * (cos / real_sqrt(d2));
+}
+
+/* [path_shadow_ray] shadow ray from surface point p to target, leaving just off p; returns its length */
+static inline real_t path_shadow_ray(vec3 p, vec3 target, vec3 *source, vec3 *dir)
+{
+    vec3_sub(target, p, dir);
+    vec3_normalize(*dir, dir);
+
+    // nudge a bit
+    vec3_mul(*dir, 0.001, source);
+    vec3_add(p, *source, source);
+
+    vec3 to_target;
+    vec3_sub(target, *source, &to_target);
+    return vec3_norm(to_target);
+}
+
+/* [path_roulette] Russian roulette: false to end a path, otherwise its throughput is weighted up */
+static inline bool path_roulette(rng_t *rng, vec3 *throughput)
+{
+    real_t q = real_min(real_max(throughput->x, real_max(throughput->y, throughput->z)), 0.95);
+    if (rng_real(rng) >= q)
+        return false;
+    vec3_mul(*throughput, 1.0 / q, throughput);
+    return true;
+}
+
+/* [path_bounce] cosine-distributed direction around unit normal n */
+static inline vec3 path_bounce(rng_t *rng, vec3 n)
+{
+    // orthonormal basis around n (Duff et al., "Building an Orthonormal Basis, Revisited")
+    real_t sign = n.z >= 0.0 ? 1.0 : -1.0;
+    real_t a = -1.0 / (sign + n.z);
+    real_t b = n.x * n.y * a;
+    vec3 t = { 1.0 + sign * n.x * n.x * a, sign * b, -sign * n.x };
+    vec3 s = { b, sign + n.y * n.y * a, -n.y };
+
+    real_t u = rng_real(rng), phi = 2.0 * M_PI * rng_real(rng);
+    real_t r = real_sqrt(u);
+    real_t x = r * cos(phi), y = r * sin(phi), z = real_sqrt(1.0 - u);
+    return (vec3) {
+        x * t.x + y * s.x + z * n.x,
+        x * t.y + y * s.y + z * n.y,
+        x * t.z + y * s.z + z * n.z,
+    };
+}
+
+/* [path_write] write the average of the paths through pixel (i, j), given their sum */
+static inline void path_write(lux_t *lux, size_t i, size_t j, vec3 sum)
+{
+    vec3_mul(sum, 255.0 / lux->path_samples, &sum);
+    ppm_write_at(lux->ppm, i, j, real_min(sum.x, 255.0), real_min(sum.y, 255.0), real_min(sum.z, 255.0));
+}
+
+size_t path_tile(lux_t *lux, tile_t tile, size_t *shadow);
+
+#endif
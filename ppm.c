@@ -2,52 +2,194 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/* rows buffered by PPM_STREAM images when no window is given */
+#define PPM_WINDOW 64
 
 ppm_t *ppm_create(char *name, size_t width, size_t height)
 {
-    ppm_t *ppm = malloc(sizeof(ppm_t));
-    ppm->f = fopen(name, "wb");
+    return ppm_open(name, width, height, 0, 0);
+}
+
+/*
+ * [ppm_open] create an image file
+ *   name: output path, NULL for an image that only lives in memory (see ppm_dump)
+ *   width, height: image dimensions
+ *   flags: PPM_BINARY, PPM_STREAM and/or PPM_MMAP
+ *   window: rows buffered at once by PPM_STREAM images, 0 picks a default
+ */
+ppm_t *ppm_open(char *name, size_t width, size_t height, int flags, size_t window)
+{
+    if (flags & PPM_MMAP)
+        flags = (flags | PPM_BINARY) & ~PPM_STREAM;
+
+    if (!name)
+        flags &= ~PPM_MMAP;
+
+    ppm_t *ppm = calloc(1, sizeof(ppm_t));
+    if (!ppm)
+        return NULL;
+    ppm->f = name ? fopen(name, flags & PPM_MMAP ? "w+b" : "wb") : NULL;
+    if (name && !ppm->f) {
+        free(ppm);
+        return NULL;
+    }
     ppm->width = width;
     ppm->height = height;
+    ppm->flags = flags;
 
     char buf[64];
-    sprintf(buf, "P3\n%zu %zu\n255\n", width, height);
-    fwrite(buf, 1, strlen(buf), ppm->f);
+    sprintf(buf, "%s\n%zu %zu\n255\n", flags & PPM_BINARY ? "P6" : "P3", width, height);
+    size_t header = strlen(buf);
+    if (ppm->f)
+        fwrite(buf, 1, header, ppm->f);
 
-    ppm->data = calloc(1, 3 * width * height);
+    ppm->row0 = 0;
+    ppm->rows = height;
+    if (flags & PPM_STREAM) {
+        ppm->rows = window ? window : PPM_WINDOW;
+        if (ppm->rows > height)
+            ppm->rows = height;
+    }
+
+    if (flags & PPM_MMAP) {
+        fflush(ppm->f);
+        ppm->map_size = header + 3 * width * height;
+        if (ftruncate(fileno(ppm->f), ppm->map_size) == 0)
+            ppm->map = mmap(NULL, ppm->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fileno(ppm->f), 0);
+        if (!ppm->map || ppm->map == MAP_FAILED) {
+            fclose(ppm->f);
+            free(ppm);
+            return NULL;
+        }
+        ppm->data = ppm->map + header;
+    } else if (!(ppm->data = calloc(1, 3 * width * ppm->rows))) {
+        if (ppm->f)
+            fclose(ppm->f);
+        free(ppm);
+        return NULL;
+    }
 
     return ppm;
 }
 
-int ppm_close(ppm_t *ppm)
+/* [write_rows] append n rows of pixels to a file */
+static int write_rows(ppm_t *ppm, FILE *f, const uint8_t *rows, size_t n)
 {
-    char buf[32];
-    uint8_t r, g, b;
-    for (size_t i = 0; i < ppm->height; i++) {
-        for (size_t j = 0; j < ppm->width; j++) {
-            r = ppm->data[3 * (i * ppm->width + j)];
-            g = ppm->data[3 * (i * ppm->width + j) + 1];
-            b = ppm->data[3 * (i * ppm->width + j) + 2];
-            sprintf(buf, "%d %d %d\n", r, g, b);
-            fwrite(buf, 1, strlen(buf), ppm->f);
+    if (ppm->flags & PPM_BINARY)
+        return fwrite(rows, 1, 3 * ppm->width * n, f) == 3 * ppm->width * n ? 0 : -1;
+
+    // format a row at a time from a table of the decimal forms of 0-255
+    static char digits[256][4];
+    static uint8_t lengths[256];
+    if (lengths[255] == 0) {
+        for (int v = 0; v < 256; v++)
+            lengths[v] = sprintf(digits[v], "%d", v);
+    }
+
+    char *buf = malloc(12 * ppm->width);
+    if (!buf)
+        return -1;
+    for (size_t j = 0; j < n; j++) {
+        char *at = buf;
+        for (size_t i = 0; i < ppm->width; i++) {
+            const uint8_t *px = &rows[3 * (j * ppm->width + i)];
+            for (int c = 0; c < 3; c++) {
+                memcpy(at, digits[px[c]], 4);
+                at += lengths[px[c]];
+                *(at++) = c < 2 ? ' ' : '\n';
+            }
         }
+        fwrite(buf, 1, at - buf, f);
     }
+    free(buf);
+    return 0;
+}
+
+/*
+ * [ppm_flush] write out the rows currently held and move on to the next window
+ *   ppm: image; only PPM_STREAM images are affected
+ */
+int ppm_flush(ppm_t *ppm)
+{
+    if (!(ppm->flags & PPM_STREAM) || ppm->row0 >= ppm->height)
+        return 0;
 
-    fclose(ppm->f);
-    free(ppm->data);
+    size_t n = ppm->row0 + ppm->rows <= ppm->height ? ppm->rows : ppm->height - ppm->row0;
+    int err = ppm->f ? write_rows(ppm, ppm->f, ppm->data, n) : 0;
+    memset(ppm->data, 0, 3 * ppm->width * ppm->rows);
+    ppm->row0 += n;
+
+    return err || (ppm->f && ferror(ppm->f)) ? -1 : 0;
+}
+
+/*
+ * [ppm_dump] write a whole buffered image, header included, to an open file
+ *   ppm: image, neither streamed nor mapped
+ *   f: destination; images dumped one after the other form a multi-image netpbm file
+ */
+int ppm_dump(ppm_t *ppm, FILE *f)
+{
+    if (ppm->flags & (PPM_STREAM | PPM_MMAP))
+        return -1;
+
+    fprintf(f, "%s\n%zu %zu\n255\n", ppm->flags & PPM_BINARY ? "P6" : "P3", ppm->width, ppm->height);
+    int err = write_rows(ppm, f, ppm->data, ppm->height);
+    return err || ferror(f) ? -1 : 0;
+}
+
+int ppm_close(ppm_t *ppm)
+{
+    if (!ppm->f) {
+        free(ppm->data);
+        free(ppm);
+        return 0;
+    }
+
+    int err = 0;
+    if (ppm->flags & PPM_MMAP) {
+        munmap(ppm->map, ppm->map_size);
+    } else if (ppm->flags & PPM_STREAM) {
+        // rows nobody flushed are written out black
+        while (ppm->row0 < ppm->height)
+            err |= ppm_flush(ppm);
+        free(ppm->data);
+    } else {
+        err = write_rows(ppm, ppm->f, ppm->data, ppm->height);
+        free(ppm->data);
+    }
+
+    // a failed write leaves nothing for fclose to report
+    if (ferror(ppm->f))
+        err = -1;
+    if (fclose(ppm->f) != 0)
+        err = -1;
     free(ppm);
 
-    return 0;
+    return err;
 }
 
 void ppm_write_at(ppm_t *ppm, size_t i, size_t j, uint8_t r, uint8_t g, uint8_t b)
 {
     assert(i < ppm->width);
-    assert(j < ppm->height);
+    assert(j >= ppm->row0 && j < ppm->row0 + ppm->rows);
 
-    uint8_t *at = &ppm->data[3 * (j * ppm->width + i)];
+    uint8_t *at = &ppm->data[3 * ((j - ppm->row0) * ppm->width + i)];
     *(at++) = r;
     *(at++) = g;
     *(at++) = b;
 }
 
+/* [ppm_read_at] color of pixel (i, j) as last written, j within the current window */
+void ppm_read_at(const ppm_t *ppm, size_t i, size_t j, uint8_t *rgb)
+{
+    assert(i < ppm->width);
+    assert(j >= ppm->row0 && j < ppm->row0 + ppm->rows);
+
+    const uint8_t *at = &ppm->data[3 * ((j - ppm->row0) * ppm->width + i)];
+    rgb[0] = at[0];
+    rgb[1] = at[1];
+    rgb[2] = at[2];
+}
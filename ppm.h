@@ -4,14 +4,35 @@
 #include <stdio.h>
 #include <stdint.h>
 
+/* ppm_open flags */
+enum {
+    /* binary P6 instead of ASCII P3 */
+    PPM_BINARY = 1 << 0,
+    /* buffer a window of rows only and write them out on every ppm_flush; memory-only
+     * images just hold the window, which can be moved anywhere through row0 */
+    PPM_STREAM = 1 << 1,
+    /* map the output file and render straight into it (implies PPM_BINARY) */
+    PPM_MMAP = 1 << 2,
+};
+
 typedef struct {
     FILE *f;
     uint8_t *data;
     size_t width, height;
+    int flags;
+    /* rows [row0, row0 + rows) are held in data */
+    size_t row0, rows;
+    /* file mapping of PPM_MMAP images */
+    uint8_t *map;
+    size_t map_size;
 } ppm_t;
 
 ppm_t *ppm_create(char *name, size_t width, size_t height);
+ppm_t *ppm_open(char *name, size_t width, size_t height, int flags, size_t window);
+int ppm_flush(ppm_t *ppm);
+int ppm_dump(ppm_t *ppm, FILE *f);
 int ppm_close(ppm_t *ppm);
 void ppm_write_at(ppm_t *ppm, size_t i, size_t j, uint8_t r, uint8_t g, uint8_t b);
+void ppm_read_at(const ppm_t *ppm, size_t i, size_t j, uint8_t *rgb);
 
 #endif
@@ -0,0 +1,42 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <stdint.h>
+#include "vec3.h"
+
+/*
+ * PCG32 random numbers: a 64-bit linear congruential state, output through a
+ * xorshift and a state-dependent rotation. Each odd increment selects an
+ * independent stream, so every pixel can have its own generator, seeded from
+ * its coordinates, and draw the same numbers whichever thread renders it.
+ */
+typedef struct {
+    uint64_t state, inc;
+} rng_t;
+
+static inline uint32_t rng_next(rng_t *rng)
+{
+    uint64_t old = rng->state;
+    rng->state = old * 6364136223846793005ULL + rng->inc;
+    uint32_t xorshifted = ((old >> 18) ^ old) >> 27;
+    uint32_t rot = old >> 59;
+    return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+}
+
+/* [rng_seed] start stream number stream of the sequence of seed */
+static inline void rng_seed(rng_t *rng, uint64_t seed, uint64_t stream)
+{
+    rng->state = 0;
+    rng->inc = stream << 1 | 1;
+    rng_next(rng);
+    rng->state += seed;
+    rng_next(rng);
+}
+
+/* [rng_real] uniform in [0, 1); 24 bits, exact in float builds too */
+static inline real_t rng_real(rng_t *rng)
+{
+    return (rng_next(rng) >> 8) * (real_t) 0x1.0p-24;
+}
+
+#endif
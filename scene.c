@@ -0,0 +1,287 @@
+#include "scene.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "parse.h"
+
+/*
+ * Scene files are text, one statement per line, # starts a comment:
+ *
+ *   camera px py pz  tx ty tz  fov           position, point looked at, fov
+ *   light  x y z                              the single light of the scene
+ *   light  x y z  r g b  radius               a point light of the light list,
+ *                                            fading out at radius (0: never)
+ *   sphere x y z  r  r g b
+ *   plane  px py pz  ux uy uz  vx vy vz  r g b
+ *   wall   px py pz  ux uy uz  vx vy vz  width  r g b
+ *   mesh   file.obj  x y z  scale  r g b      OBJ file (relative to the scene
+ *                                            file), scaled then moved to x y z
+ *
+ * The file is read in one go and parsed in a single pass; objects go to one
+ * growing array per type, so there is no allocation per object. Once parsed,
+ * every array moves to a block of the scene's arena, where meshes already
+ * are, and scene_free releases the lot at once.
+ */
+
+/* most numbers on a statement line */
+#define SCENE_ARGS 16
+
+/* [load_mesh] add a mesh statement's OBJ file to the scene */
+static int load_mesh(scene_t *scene, const char *file, const double *v, size_t *cap)
+{
+    mesh_t **meshes = parse_grow(scene->meshes, scene->mesh_num, cap, sizeof(mesh_t*));
+    if (!meshes)
+        return -1;
+    scene->meshes = meshes;
+
+    // meshes go straight to the arena: their triangles point back to them, they must not move
+    mesh_t *m = arena_alloc(&scene->arena, sizeof(mesh_t));
+    if (!m)
+        return -1;
+    scene->meshes[scene->mesh_num++] = m;
+
+    if (mesh_load_obj(m, file) != 0)
+        return -1;
+    mesh_transform(m, (vec3) { v[0], v[1], v[2] }, v[3]);
+    m->color = (vec3) { v[4], v[5], v[6] };
+    return 0;
+}
+
+/* [parse_line] apply one statement, v holding its n numbers and file its file argument, if any */
+static int parse_line(scene_t *scene, const char *word, size_t len, const char *file, const double *v, size_t n,
+                      size_t *caps)
+{
+#define IS(name, args) (len == sizeof(name) - 1 && !memcmp(word, name, len) && n == (args))
+#define VEC(k) ((vec3) { v[k], v[(k) + 1], v[(k) + 2] })
+
+    if (IS("sphere", 7)) {
+        sphere_t *s = parse_grow(scene->spheres, scene->sphere_num, &caps[0], sizeof(sphere_t));
+        if (!s)
+            return -1;
+        scene->spheres = s;
+        s[scene->sphere_num++] = (sphere_t) { .pos = VEC(0), .r = v[3], .color = VEC(4) };
+    } else if (IS("plane", 12)) {
+        plane_t *p = parse_grow(scene->planes, scene->plane_num, &caps[1], sizeof(plane_t));
+        if (!p)
+            return -1;
+        scene->planes = p;
+        p[scene->plane_num++] = (plane_t) { .p = VEC(0), .u = VEC(3), .v = VEC(6), .color = VEC(9) };
+    } else if (IS("wall", 13)) {
+        wall_t *w = parse_grow(scene->walls, scene->wall_num, &caps[2], sizeof(wall_t));
+        if (!w)
+            return -1;
+        scene->walls = w;
+        w[scene->wall_num++] = (wall_t) {
+            .p = VEC(0), .u = VEC(3), .v = VEC(6), .width = v[9], .color = VEC(10)
+        };
+    } else if (IS("camera", 7)) {
+        vec3 watch;
+        vec3_sub(VEC(3), VEC(0), &watch);
+        scene->camera = camera_build(watch, VEC(0), v[6]);
+        scene->has_camera = true;
+    } else if (IS("light", 3)) {
+        scene->light = VEC(0);
+        scene->has_light = true;
+    } else if (IS("light", 7)) {
+        light_t *l = parse_grow(scene->lights, scene->light_num, &caps[3], sizeof(light_t));
+        if (!l)
+            return -1;
+        scene->lights = l;
+        l[scene->light_num++] = (light_t) { .pos = VEC(0), .color = VEC(3), .radius = v[6] };
+    } else if (IS("mesh", 7) && file) {
+        return load_mesh(scene, file, v, &caps[4]);
+    } else {
+        return -1;
+    }
+    return 0;
+
+#undef IS
+#undef VEC
+}
+
+/* [pack] move an array grown while parsing to a block of the arena; clears *num if memory runs out */
+static void *pack(arena_t *arena, void *array, size_t *num, size_t size)
+{
+    void *block = *num ? arena_alloc(arena, *num * size) : NULL;
+    if (block)
+        memcpy(block, array, *num * size);
+    else
+        *num = 0;
+    free(array);
+    return block;
+}
+
+/* [scene_pack] move the arrays of a parsed scene, meshes' included, to its arena */
+static int scene_pack(scene_t *scene)
+{
+    arena_t *arena = &scene->arena;
+    size_t objects = scene->sphere_num + scene->plane_num + scene->wall_num + scene->light_num;
+    size_t meshes = scene->mesh_num;
+
+    scene->spheres = pack(arena, scene->spheres, &scene->sphere_num, sizeof(sphere_t));
+    scene->planes = pack(arena, scene->planes, &scene->plane_num, sizeof(plane_t));
+    scene->walls = pack(arena, scene->walls, &scene->wall_num, sizeof(wall_t));
+    scene->lights = pack(arena, scene->lights, &scene->light_num, sizeof(light_t));
+    int err = objects == scene->sphere_num + scene->plane_num + scene->wall_num + scene->light_num ? 0 : -1;
+
+    for (size_t k = 0; k < scene->mesh_num; k++) {
+        mesh_t *m = scene->meshes[k];
+        size_t vertices = m->vertex_num, triangles = m->triangle_num;
+        m->vertices = pack(arena, m->vertices, &m->vertex_num, sizeof(vec3));
+        m->triangles = pack(arena, m->triangles, &m->triangle_num, sizeof(triangle_t));
+        if (m->vertex_num != vertices || m->triangle_num != triangles)
+            err = -1;
+    }
+    scene->meshes = pack(arena, scene->meshes, &scene->mesh_num, sizeof(mesh_t*));
+    return err || scene->mesh_num != meshes ? -1 : 0;
+}
+
+/*
+ * [scene_load] read a scene file
+ *   scene: scene to fill, free with scene_free even on failure
+ *   path: scene file
+ * On a syntax error scene->error_line is the offending line (0 if the file
+ * could not be read).
+ */
+int scene_load(scene_t *scene, const char *path)
+{
+    memset(scene, 0, sizeof(scene_t));
+    char *buf = parse_read_file(path);
+    if (!buf)
+        return -1;
+
+    int err = scene_parse(scene, buf, path);
+    free(buf);
+    return err;
+}
+
+/*
+ * [scene_parse] read scene statements from memory
+ *   scene: scene to fill, free with scene_free even on failure
+ *   text: statements, NUL terminated
+ *   path: file the statements come from, NULL for none; mesh files are
+ *         relative to its directory, or to the current one
+ * On a syntax error scene->error_line is the offending line.
+ */
+int scene_parse(scene_t *scene, const char *text, const char *path)
+{
+    memset(scene, 0, sizeof(scene_t));
+
+    // files named in the scene are relative to its directory
+    const char *slash = path ? strrchr(path, '/') : NULL;
+    size_t dir = slash ? slash - path + 1 : 0;
+    char file[4096];
+
+    size_t caps[5] = { 0, 0, 0, 0, 0 };
+    size_t line = 1;
+    const char *at = text;
+    int err = 0;
+
+    while (*at && !err) {
+        while (*at == ' ' || *at == '\t' || *at == '\r')
+            at++;
+
+        const char *word = at;
+        while ((*at >= 'a' && *at <= 'z') || (*at >= 'A' && *at <= 'Z'))
+            at++;
+        size_t len = at - word;
+
+        // mesh takes a file name before its numbers
+        bool has_file = len == 4 && !memcmp(word, "mesh", 4);
+        if (has_file) {
+            while (*at == ' ' || *at == '\t')
+                at++;
+            size_t name = strcspn(at, " \t\r\n");
+            if (!name || dir + name >= sizeof(file)) {
+                scene->error_line = line;
+                err = -1;
+                break;
+            }
+            size_t prefix = *at == '/' ? 0 : dir;
+            if (prefix)
+                memcpy(file, path, prefix);
+            memcpy(file + prefix, at, name);
+            file[prefix + name] = '\0';
+            at += name;
+        }
+
+        double v[SCENE_ARGS];
+        size_t n = 0;
+        while (n < SCENE_ARGS && parse_real(&at, &v[n]))
+            n++;
+
+        while (*at == ' ' || *at == '\t' || *at == '\r')
+            at++;
+        if (*at == '#') {
+            while (*at && *at != '\n')
+                at++;
+        }
+        if (*at && *at != '\n')
+            err = -1;
+        else if (len || n)
+            err = parse_line(scene, word, len, has_file ? file : NULL, v, n, caps);
+
+        if (err)
+            scene->error_line = line;
+        else if (*at)
+            at++, line++;
+    }
+
+    // even a failed parse is packed: scene_free then only has the arena to release
+    if (scene_pack(scene) != 0)
+        err = -1;
+    return err;
+}
+
+/*
+ * [scene_submit] hand a loaded scene to lux: camera and light if the file
+ * sets them, its light list, one job per primitive type that has objects and
+ * one per mesh
+ *   scene: scene, must outlive lux's use of its objects
+ *   lux: lux context
+ */
+int scene_submit(scene_t *scene, lux_t *lux)
+{
+    if (scene->has_camera)
+        lux->camera = scene->camera;
+    if (scene->has_light)
+        lux->light = scene->light;
+
+    job_t types[3] = {
+        {
+            .data = (uint8_t*) scene->planes, .obj_size = sizeof(plane_t), .obj_num = scene->plane_num,
+            .test = &test_ray_plane, .bounds = NULL, .normal = &normal_plane,
+        },
+        {
+            .data = (uint8_t*) scene->spheres, .obj_size = sizeof(sphere_t), .obj_num = scene->sphere_num,
+            .test = &test_ray_sphere, .bounds = &bound_sphere, .normal = &normal_sphere,
+        },
+        {
+            .data = (uint8_t*) scene->walls, .obj_size = sizeof(wall_t), .obj_num = scene->wall_num,
+            .test = &test_ray_wall, .bounds = &bound_wall, .normal = &normal_wall,
+        },
+    };
+
+    for (size_t k = 0; k < scene->light_num; k++) {
+        if (lux_add_light(lux, &scene->lights[k]) != 0)
+            return -1;
+    }
+    for (size_t k = 0; k < 3; k++) {
+        if (types[k].obj_num && lux_submit_job(lux, &types[k]) != 0)
+            return -1;
+    }
+    for (size_t k = 0; k < scene->mesh_num; k++) {
+        job_t job;
+        mesh_job(scene->meshes[k], &job);
+        if (lux_submit_job(lux, &job) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+/* [scene_free] release the objects of a scene, whether it was parsed or not */
+void scene_free(scene_t *scene)
+{
+    arena_free(&scene->arena);
+    memset(scene, 0, sizeof(scene_t));
+}
@@ -0,0 +1,38 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include "lux.h"
+#include "geometry.h"
+#include "mesh.h"
+
+/*
+ * A scene read from a file: camera, lights, one array per primitive type,
+ * each submitted as a single job, and meshes.
+ */
+typedef struct {
+    camera_t camera;
+    bool has_camera;
+    vec3 light;
+    bool has_light;
+    light_t *lights;
+    size_t light_num;
+    sphere_t *spheres;
+    size_t sphere_num;
+    plane_t *planes;
+    size_t plane_num;
+    wall_t *walls;
+    size_t wall_num;
+    mesh_t **meshes;
+    size_t mesh_num;
+    /* where the arrays above, meshes and their arrays included, live once parsed */
+    arena_t arena;
+    /* line of the first error of scene_load */
+    size_t error_line;
+} scene_t;
+
+int scene_load(scene_t *scene, const char *path);
+int scene_parse(scene_t *scene, const char *text, const char *path);
+int scene_submit(scene_t *scene, lux_t *lux);
+void scene_free(scene_t *scene);
+
+#endif
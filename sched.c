@@ -0,0 +1,159 @@
+#include "sched.h"
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <unistd.h>
+
+/*
+ * Work-stealing scheduler over a fixed range of task indices.
+ *
+ * Every worker owns a deque holding a contiguous range [lo, hi) of tasks. The
+ * owner pops from the front; an idle worker steals the back half of a victim's
+ * range. Since tasks are plain indices a range is enough to represent a deque,
+ * and stealing half keeps the number of steals logarithmic in the task count.
+ */
+
+typedef struct {
+    pthread_mutex_t lock;
+    size_t lo, hi;
+} deque_t;
+
+typedef struct {
+    deque_t *deques;
+    size_t nthreads;
+    sched_fn *fn;
+    void *ctx;
+} pool_t;
+
+typedef struct {
+    pool_t *pool;
+    size_t id;
+} worker_t;
+
+static bool deque_pop(deque_t *d, size_t *task)
+{
+    bool ok = false;
+    pthread_mutex_lock(&d->lock);
+    if (d->lo < d->hi) {
+        *task = d->lo++;
+        ok = true;
+    }
+    pthread_mutex_unlock(&d->lock);
+    return ok;
+}
+
+/* [deque_steal] move the back half of victim's range into thief (which must be empty) */
+static bool deque_steal(deque_t *victim, deque_t *thief)
+{
+    size_t lo, hi;
+    pthread_mutex_lock(&victim->lock);
+    hi = victim->hi;
+    lo = victim->lo + (victim->hi - victim->lo) / 2;
+    victim->hi = lo;
+    pthread_mutex_unlock(&victim->lock);
+
+    if (lo >= hi)
+        return false;
+
+    pthread_mutex_lock(&thief->lock);
+    thief->lo = lo;
+    thief->hi = hi;
+    pthread_mutex_unlock(&thief->lock);
+    return true;
+}
+
+static void *worker_main(void *arg)
+{
+    worker_t *w = (worker_t*) arg;
+    pool_t *pool = w->pool;
+    deque_t *own = &pool->deques[w->id];
+    size_t task;
+
+    for (;;) {
+        while (deque_pop(own, &task))
+            pool->fn(pool->ctx, task, w->id);
+
+        // out of work: try to steal from the others, starting with our neighbour
+        bool stolen = false;
+        for (size_t k = 1; k < pool->nthreads && !stolen; k++)
+            stolen = deque_steal(&pool->deques[(w->id + k) % pool->nthreads], own);
+
+        // nothing left to steal: any task still in flight between two deques
+        // belongs to a thief that is running and will execute it itself
+        if (!stolen)
+            break;
+    }
+
+    return NULL;
+}
+
+size_t sched_default_threads(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (size_t) n : 1;
+}
+
+/*
+ * [sched_run] run fn on every task in [0, ntasks) and wait for completion
+ *   nthreads: number of workers, the calling thread being worker 0
+ *   ntasks: number of tasks
+ *   fn: task callback
+ *   ctx: user context passed to fn
+ * returns -1, before running any task, if memory runs out; threads that
+ * cannot be created leave their tasks to the others
+ */
+int sched_run(size_t nthreads, size_t ntasks, sched_fn *fn, void *ctx)
+{
+    if (nthreads == 0)
+        nthreads = 1;
+    if (nthreads > ntasks)
+        nthreads = ntasks > 0 ? ntasks : 1;
+
+    if (nthreads == 1) {
+        for (size_t t = 0; t < ntasks; t++)
+            fn(ctx, t, 0);
+        return 0;
+    }
+
+    pool_t pool = {
+        .deques = malloc(sizeof(deque_t) * nthreads),
+        .nthreads = nthreads,
+        .fn = fn,
+        .ctx = ctx,
+    };
+    worker_t *workers = malloc(sizeof(worker_t) * nthreads);
+    pthread_t *threads = malloc(sizeof(pthread_t) * nthreads);
+    if (!pool.deques || !workers || !threads) {
+        free(threads);
+        free(workers);
+        free(pool.deques);
+        return -1;
+    }
+
+    // hand out contiguous chunks so neighbouring tasks start on the same worker
+    for (size_t w = 0; w < nthreads; w++) {
+        pthread_mutex_init(&pool.deques[w].lock, NULL);
+        pool.deques[w].lo = ntasks * w / nthreads;
+        pool.deques[w].hi = ntasks * (w + 1) / nthreads;
+        workers[w] = (worker_t) { .pool = &pool, .id = w };
+    }
+
+    size_t spawned = 1;
+    for (; spawned < nthreads; spawned++) {
+        if (pthread_create(&threads[spawned], NULL, worker_main, &workers[spawned]) != 0)
+            break;
+    }
+
+    // if thread creation failed the remaining deques get stolen by whoever is running
+    worker_main(&workers[0]);
+
+    for (size_t w = 1; w < spawned; w++)
+        pthread_join(threads[w], NULL);
+
+    for (size_t w = 0; w < nthreads; w++)
+        pthread_mutex_destroy(&pool.deques[w].lock);
+    free(threads);
+    free(workers);
+    free(pool.deques);
+    return 0;
+}
@@ -0,0 +1,17 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stddef.h>
+
+/*
+ * [sched_fn] task callback
+ *   ctx: user context passed to sched_run
+ *   task: task index in [0, ntasks)
+ *   worker: index of the worker running the task, in [0, nthreads)
+ */
+typedef void sched_fn(void *ctx, size_t task, size_t worker);
+
+size_t sched_default_threads(void);
+int sched_run(size_t nthreads, size_t ntasks, sched_fn *fn, void *ctx);
+
+#endif
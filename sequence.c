@@ -0,0 +1,292 @@
+#include "sequence.h"
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include "sched.h"
+#include "shadowmap.h"
+
+/*
+ * [sequence_load] read keyframes, one per line as
+ *   time px py pz tx ty tz fov
+ * (camera position, point looked at, fov); blank lines and lines starting
+ * with # are skipped. Keyframes must come in increasing time order.
+ *   seq: sequence whose keys are replaced, free seq->keys when done
+ *   f: keyframe file
+ */
+int sequence_load(sequence_t *seq, FILE *f)
+{
+    keyframe_t *keys = NULL;
+    size_t num = 0, cap = 0;
+    char line[256];
+
+    while (fgets(line, sizeof(line), f)) {
+        char *at = line + strspn(line, " \t");
+        if (*at == '#' || *at == '\n' || *at == '\0')
+            continue;
+
+        double v[8];
+        if (sscanf(at, "%lf %lf %lf %lf %lf %lf %lf %lf",
+                   &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]) != 8
+            || (num && v[0] <= keys[num - 1].time)) {
+            free(keys);
+            return -1;
+        }
+
+        if (num == cap) {
+            size_t more = cap ? 2 * cap : 16;
+            keyframe_t *grown = realloc(keys, more * sizeof(keyframe_t));
+            if (!grown) {
+                free(keys);
+                return -1;
+            }
+            keys = grown;
+            cap = more;
+        }
+        keys[num++] = (keyframe_t) {
+            .time = v[0],
+            .pos = { v[1], v[2], v[3] },
+            .target = { v[4], v[5], v[6] },
+            .fov = v[7],
+        };
+    }
+
+    if (!num)
+        return -1;
+    seq->keys = keys;
+    seq->key_num = num;
+    return 0;
+}
+
+/*
+ * [sequence_frame_name] file name of a frame: pattern with its one %d
+ * conversion (%04d zero-pads to a width) replaced by the frame number, and
+ * %% by %
+ *   pattern: output pattern, see sequence_t.out
+ *   frame: frame number
+ *   name, size: where the name goes
+ * returns the number of %d conversions in pattern (0 or 1), -1 for any other
+ * conversion or a name that does not fit
+ */
+int sequence_frame_name(const char *pattern, size_t frame, char *name, size_t size)
+{
+    int conversions = 0;
+    size_t n = 0;
+
+    for (const char *at = pattern; *at; at++) {
+        char number[32];
+        const char *piece = at;
+        size_t len = 1;
+
+        if (*at == '%' && *++at != '%') {
+            bool zero = *at == '0';
+            int width = 0;
+            for (at += zero; *at >= '0' && *at <= '9' && width <= 20; at++)
+                width = 10 * width + (*at - '0');
+            if (*at != 'd' || width > 20 || conversions++)
+                return -1;
+            len = snprintf(number, sizeof(number), zero ? "%0*zu" : "%*zu", width, frame);
+            piece = number;
+        } else {
+            piece = at;
+        }
+
+        if (n + len >= size)
+            return -1;
+        memcpy(name + n, piece, len);
+        n += len;
+    }
+
+    name[n] = '\0';
+    return conversions;
+}
+
+/* [catmull_rom] uniform Catmull-Rom spline through p1 (u = 0) and p2 (u = 1) */
+static real_t catmull_rom(real_t p0, real_t p1, real_t p2, real_t p3, real_t u)
+{
+    return 0.5 * (2 * p1 + (p2 - p0) * u
+                  + (2 * p0 - 5 * p1 + 4 * p2 - p3) * u * u
+                  + (3 * p1 - p0 - 3 * p2 + p3) * u * u * u);
+}
+
+static vec3 catmull_rom_vec3(vec3 p0, vec3 p1, vec3 p2, vec3 p3, real_t u)
+{
+    return (vec3) {
+        catmull_rom(p0.x, p1.x, p2.x, p3.x, u),
+        catmull_rom(p0.y, p1.y, p2.y, p3.y, u),
+        catmull_rom(p0.z, p1.z, p2.z, p3.z, u),
+    };
+}
+
+/*
+ * [sequence_camera] camera of a frame: position and target follow a
+ * Catmull-Rom spline through the keyframes, the fov is interpolated linearly
+ *   seq: sequence
+ *   frame: frame number in [0, seq->frames)
+ */
+camera_t sequence_camera(const sequence_t *seq, size_t frame)
+{
+    const keyframe_t *keys = seq->keys;
+    size_t last = seq->key_num - 1;
+
+    real_t t = keys[0].time;
+    if (seq->frames > 1)
+        t += (keys[last].time - keys[0].time) * frame / (seq->frames - 1);
+
+    size_t k = 0;
+    while (k + 1 < last && t > keys[k + 1].time)
+        k++;
+    size_t k1 = k < last ? k + 1 : k;
+    size_t k0 = k ? k - 1 : k;
+    size_t k2 = k1 < last ? k1 + 1 : k1;
+
+    real_t u = 0;
+    if (k1 != k) {
+        u = (t - keys[k].time) / (keys[k1].time - keys[k].time);
+        u = real_min(real_max(u, 0), 1);
+    }
+
+    vec3 pos = catmull_rom_vec3(keys[k0].pos, keys[k].pos, keys[k1].pos, keys[k2].pos, u);
+    vec3 target = catmull_rom_vec3(keys[k0].target, keys[k].target, keys[k1].target, keys[k2].target, u);
+    real_t fov = keys[k].fov + (keys[k1].fov - keys[k].fov) * u;
+
+    vec3 watch;
+    vec3_sub(target, pos, &watch);
+    return camera_build(watch, pos, fov);
+}
+
+typedef struct {
+    lux_t *lux;
+    const sequence_t *seq;
+    /* first frame of the batch */
+    size_t f0;
+    /* render threads of each frame */
+    size_t threads;
+    /* finished in-memory frames of a single file sequence, in batch order */
+    ppm_t **done;
+    int err;
+} batch_t;
+
+/* [render_frame_task] sched_fn rendering frame f0 + task on a copy of the scene's lux_t */
+static void render_frame_task(void *ctx, size_t task, size_t worker)
+{
+    (void) worker;
+    batch_t *batch = ctx;
+    const sequence_t *seq = batch->seq;
+    size_t frame = batch->f0 + task;
+    size_t pixels = seq->width * seq->height;
+
+    ppm_t *ppm;
+    if (batch->done) {
+        ppm = ppm_open(NULL, seq->width, seq->height, seq->flags & PPM_BINARY, 0);
+    } else {
+        char name[4096];
+        ppm = sequence_frame_name(seq->out, frame, name, sizeof(name)) == 1
+            ? ppm_open(name, seq->width, seq->height, seq->flags, 0) : NULL;
+    }
+    float *depth = malloc(sizeof(float) * pixels);
+    if (!ppm || !depth) {
+        if (ppm)
+            ppm_close(ppm);
+        free(depth);
+        __atomic_store_n(&batch->err, -1, __ATOMIC_RELAXED);
+        return;
+    }
+    for (size_t i = 0; i < pixels; i++)
+        depth[i] = FLT_MAX;
+
+    // the copy shares jobs and bvh with the scene, everything per frame is its own
+    lux_t lux = *batch->lux;
+    lux.ppm = ppm;
+    lux.depth = depth;
+    lux.camera = sequence_camera(seq, frame);
+    lux.frame = (camera_frame_t) { 0 };
+    lux.gbuffer = (gbuffer_t) { 0 };
+    lux.threads = batch->threads;
+    lux.stats = NULL;
+
+    int err = lux_render(&lux);
+    camera_frame_free(&lux.frame);
+    gbuffer_free(&lux.gbuffer);
+    free(depth);
+
+    __atomic_add_fetch(&batch->lux->primary_rays, lux.primary_rays, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&batch->lux->shadow_rays, lux.shadow_rays, __ATOMIC_RELAXED);
+
+    if (batch->done)
+        batch->done[task] = ppm;
+    else if (ppm_close(ppm) != 0)
+        err = -1;
+    if (err)
+        __atomic_store_n(&batch->err, -1, __ATOMIC_RELAXED);
+}
+
+/*
+ * [lux_render_sequence] render every frame of an animation
+ *   lux: scene (jobs, light, threads, packet, tile_size); ppm, depth and
+ *        camera are not used
+ *   seq: camera path and output
+ *
+ * The bvh and shadow maps are built once and shared. Frames are rendered seq->parallel at a
+ * time, each one on its share of the render threads, so that small frames
+ * still keep every core busy. A single file output gets the frames in order
+ * as consecutive images (ffmpeg -f ppm_pipe reads it as a video).
+ */
+int lux_render_sequence(lux_t *lux, const sequence_t *seq)
+{
+    if (!seq->key_num || !seq->frames)
+        return -1;
+    if ((lux->dirty || !lux->bvh) && lux_commit(lux) != 0)
+        return -1;
+
+    size_t threads = lux->threads ? lux->threads : sched_default_threads();
+    size_t parallel = seq->parallel ? seq->parallel : threads;
+    if (parallel > seq->frames)
+        parallel = seq->frames;
+
+    // shadow maps do not depend on the camera: render them once for every frame
+    lux->primary_rays = lux->shadow_rays = 0;
+    if (lux->shadow_map && shadow_maps_update(lux, threads) != 0)
+        return -1;
+
+    batch_t batch = {
+        .lux = lux,
+        .seq = seq,
+        .threads = threads > parallel ? threads / parallel : 1,
+    };
+
+    FILE *f = NULL;
+    char name[4096];
+    int numbered = sequence_frame_name(seq->out, 0, name, sizeof(name));
+    if (numbered < 0)
+        return -1;
+    if (!numbered) {
+        if (!(f = fopen(name, "wb")))
+            return -1;
+        if (!(batch.done = calloc(parallel, sizeof(ppm_t*)))) {
+            fclose(f);
+            return -1;
+        }
+    }
+
+    for (batch.f0 = 0; batch.f0 < seq->frames && !batch.err; batch.f0 += parallel) {
+        size_t n = seq->frames - batch.f0 < parallel ? seq->frames - batch.f0 : parallel;
+        if (sched_run(parallel, n, render_frame_task, &batch) != 0)
+            batch.err = -1;
+
+        if (!f)
+            continue;
+        for (size_t i = 0; i < n; i++) {
+            if (!batch.done[i])
+                continue;
+            if (!batch.err && ppm_dump(batch.done[i], f) != 0)
+                batch.err = -1;
+            ppm_close(batch.done[i]);
+            batch.done[i] = NULL;
+        }
+    }
+
+    if (f && fclose(f) != 0)
+        batch.err = -1;
+    free(batch.done);
+    return batch.err;
+}
@@ -0,0 +1,39 @@
+#ifndef SEQUENCE_H
+#define SEQUENCE_H
+
+#include <stdio.h>
+#include "lux.h"
+
+/* camera state at a point in time */
+typedef struct {
+    real_t time;
+    vec3 pos;
+    vec3 target;
+    real_t fov;
+} keyframe_t;
+
+/*
+ * An animation: a camera path through keyframes sorted by time, sampled at
+ * frames evenly spaced instants from the first keyframe to the last.
+ */
+typedef struct {
+    keyframe_t *keys;
+    size_t key_num;
+    size_t frames;
+    size_t width, height;
+    /* pattern with one %d conversion, zero-padded or not (out_%04d.ppm), for
+     * numbered files, plain path for a single multi-image file in frame order;
+     * %% stands for % (see sequence_frame_name) */
+    const char *out;
+    /* ppm_open flags of the frames */
+    int flags;
+    /* frames rendered at once, 0 picks one per render thread */
+    size_t parallel;
+} sequence_t;
+
+int sequence_load(sequence_t *seq, FILE *f);
+int sequence_frame_name(const char *pattern, size_t frame, char *name, size_t size);
+camera_t sequence_camera(const sequence_t *seq, size_t frame);
+int lux_render_sequence(lux_t *lux, const sequence_t *seq);
+
+#endif
@@ -0,0 +1,327 @@
+#include "server.h"
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "scene.h"
+#include "sock.h"
+
+/*
+ * Render server: a process keeping a committed scene, its hierarchy, shadow
+ * maps, image and depth buffers in memory, and rendering frames for clients
+ * of a Unix socket. On a connection, clients send any number of requests:
+ *
+ *   client -> server: server_request_t, then delta_size bytes of scene file
+ *                     statements (see scene.c) added to the resident scene
+ *   server -> client: server_reply_t, then a binary PPM file of size bytes
+ *
+ * Like for lux_render_distributed, both ends are expected to be built from
+ * the same sources, structures go over the wire as they are.
+ *
+ * Deltas add up from one request to the next, until a request asks for
+ * SERVER_RESET. Objects and lights of a delta only cost a hierarchy rebuild;
+ * requests that change nothing but the camera render straight away, and the
+ * buffers are only reallocated when the resolution changes. Requests are
+ * answered one at a time, each render using every render thread. A request
+ * is read in one go once its first bytes arrive; clients that stall in the
+ * middle of one for SERVER_TIMEOUT_MS are hung up on, so they cannot hold
+ * up the others.
+ */
+
+typedef struct {
+    lux_t *lux;
+    /* the scene lux_serve started with, restored by SERVER_RESET */
+    size_t job_num, light_num;
+    camera_t camera;
+    vec3 light;
+    /* deltas applied since, whose objects lux points to */
+    scene_t *deltas;
+    size_t delta_num;
+} server_t;
+
+static volatile sig_atomic_t server_stop;
+
+static void server_signal(int sig)
+{
+    (void) sig;
+    server_stop = 1;
+}
+
+/* [server_rewind] drop the jobs and lights submitted after the first job_num and light_num */
+static void server_rewind(lux_t *lux, size_t job_num, size_t light_num)
+{
+    if (lux->job_num != job_num || lux->light_num != light_num)
+        lux->dirty = true;
+    lux->job_num = job_num;
+    lux->light_num = light_num;
+}
+
+/* [server_reset] go back to the scene lux_serve started with */
+static void server_reset(server_t *srv)
+{
+    server_rewind(srv->lux, srv->job_num, srv->light_num);
+    srv->lux->camera = srv->camera;
+    srv->lux->light = srv->light;
+
+    for (size_t k = 0; k < srv->delta_num; k++)
+        scene_free(&srv->deltas[k]);
+    free(srv->deltas);
+    srv->deltas = NULL;
+    srv->delta_num = 0;
+}
+
+/*
+ * [server_apply] add the statements of a delta to the resident scene; a
+ * delta that cannot be applied leaves the scene as it was
+ *   srv: server
+ *   text: scene statements, NUL terminated
+ *   error_line: set to the line of the first syntax error
+ */
+static int server_apply(server_t *srv, const char *text, uint32_t *error_line)
+{
+    lux_t *lux = srv->lux;
+    scene_t *deltas = realloc(srv->deltas, sizeof(scene_t) * (srv->delta_num + 1));
+    if (!deltas)
+        return SERVER_RENDER_FAILED;
+    srv->deltas = deltas;
+
+    scene_t *delta = &srv->deltas[srv->delta_num];
+    if (scene_parse(delta, text, NULL) != 0) {
+        *error_line = delta->error_line;
+        scene_free(delta);
+        return SERVER_BAD_DELTA;
+    }
+
+    size_t job_num = lux->job_num, light_num = lux->light_num;
+    camera_t camera = lux->camera;
+    vec3 light = lux->light;
+    if (scene_submit(delta, lux) != 0) {
+        server_rewind(lux, job_num, light_num);
+        lux->camera = camera;
+        lux->light = light;
+        scene_free(delta);
+        return SERVER_RENDER_FAILED;
+    }
+    srv->delta_num++;
+    return SERVER_OK;
+}
+
+/* [server_frame] image and depth buffer of a resolution, cleared for a new frame */
+static int server_frame(lux_t *lux, size_t width, size_t height)
+{
+    if (!lux->ppm || !lux->depth || lux->ppm->width != width || lux->ppm->height != height) {
+        if (lux->ppm)
+            ppm_close(lux->ppm);
+        free(lux->depth);
+        lux->ppm = ppm_open(NULL, width, height, PPM_BINARY, 0);
+        lux->depth = malloc(sizeof(float) * width * height);
+        if (lux->ppm && !lux->ppm->data) {
+            ppm_close(lux->ppm);
+            lux->ppm = NULL;
+        }
+        if (!lux->ppm || !lux->depth)
+            return -1;
+    }
+
+    memset(lux->ppm->data, 0, 3 * width * height);
+    for (size_t i = 0; i < width * height; i++)
+        lux->depth[i] = FLT_MAX;
+    return 0;
+}
+
+/* [server_render] render the frame a request asks for into lux's buffers */
+static int server_render(lux_t *lux, const server_request_t *req)
+{
+    if (server_frame(lux, req->width, req->height) != 0)
+        return SERVER_RENDER_FAILED;
+
+    camera_t camera = lux->camera;
+    if (req->flags & SERVER_CAMERA) {
+        vec3 pos = { req->pos[0], req->pos[1], req->pos[2] };
+        vec3 target = { req->target[0], req->target[1], req->target[2] };
+        vec3 watch;
+        vec3_sub(target, pos, &watch);
+        lux->camera = camera_build(watch, pos, req->fov);
+    }
+
+    int err = lux_render(lux);
+    lux->camera = camera;
+    return err ? SERVER_RENDER_FAILED : SERVER_OK;
+}
+
+/* [server_answer] read a request from a client and answer it, -1 once the connection is over */
+static int server_answer(server_t *srv, int fd)
+{
+    lux_t *lux = srv->lux;
+    server_request_t req;
+    if (sock_read_full(fd, &req, sizeof(server_request_t)) != 0)
+        return -1;
+
+    server_reply_t reply = { .status = SERVER_OK };
+    size_t pixels = (size_t) req.width * req.height;
+    bool camera_ok = !(req.flags & SERVER_CAMERA) || (req.fov > 0 && req.fov < 90);
+    if (!pixels || pixels > SERVER_MAX_PIXELS || req.delta_size > SERVER_MAX_DELTA || !camera_ok) {
+        // the rest of the stream cannot be trusted: answer, then hang up
+        reply.status = SERVER_BAD_REQUEST;
+        sock_write_full(fd, &reply, sizeof(server_reply_t));
+        return -1;
+    }
+
+    if (req.flags & SERVER_RESET)
+        server_reset(srv);
+    if (req.delta_size) {
+        char *text = malloc(req.delta_size + 1);
+        if (!text || sock_read_full(fd, text, req.delta_size) != 0) {
+            free(text);
+            return -1;
+        }
+        text[req.delta_size] = '\0';
+        reply.status = server_apply(srv, text, &reply.error_line);
+        free(text);
+    }
+
+    if (reply.status == SERVER_OK)
+        reply.status = server_render(lux, &req);
+    if (reply.status != SERVER_OK)
+        return sock_write_full(fd, &reply, sizeof(server_reply_t));
+
+    char header[64];
+    size_t n = sprintf(header, "P6\n%u %u\n255\n", req.width, req.height);
+    reply.size = n + 3 * pixels;
+    reply.primary_rays = lux->primary_rays;
+    reply.shadow_rays = lux->shadow_rays;
+    if (sock_write_full(fd, &reply, sizeof(server_reply_t)) != 0
+        || sock_write_full(fd, header, n) != 0
+        || sock_write_full(fd, lux->ppm->data, 3 * pixels) != 0)
+        return -1;
+    return 0;
+}
+
+/*
+ * [lux_serve] answer render requests on a Unix socket until SIGINT or SIGTERM
+ *   lux: lux context holding the scene; ppm and depth are managed by the
+ *        server and must be NULL
+ *   path: socket path, removed on return
+ */
+int lux_serve(lux_t *lux, const char *path)
+{
+    if ((lux->dirty || !lux->bvh) && lux_commit(lux) != 0)
+        return -1;
+    int lfd = sock_listen(path);
+    if (lfd < 0)
+        return -1;
+
+    server_t srv = {
+        .lux = lux,
+        .job_num = lux->job_num,
+        .light_num = lux->light_num,
+        .camera = lux->camera,
+        .light = lux->light,
+    };
+
+    struct sigaction sa = { .sa_handler = server_signal }, old_int, old_term;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, &old_int);
+    sigaction(SIGTERM, &sa, &old_term);
+    server_stop = 0;
+
+    // the listening socket first, then one entry per connected client
+    size_t nfds = 1, cap = 16;
+    struct pollfd *fds = malloc(sizeof(struct pollfd) * cap);
+    int err = fds ? 0 : -1;
+    if (fds)
+        fds[0] = (struct pollfd) { .fd = lfd, .events = POLLIN };
+
+    while (!err && !server_stop) {
+        if (poll(fds, nfds, -1) < 0) {
+            if (errno != EINTR)
+                err = -1;
+            continue;
+        }
+
+        // backwards, so that the entry moved over a closed one was already seen
+        for (size_t k = nfds; k-- > 1;) {
+            if (fds[k].revents && server_answer(&srv, fds[k].fd) != 0) {
+                close(fds[k].fd);
+                fds[k] = fds[--nfds];
+            }
+        }
+
+        if (fds[0].revents & POLLIN) {
+            int fd = accept(lfd, NULL, NULL);
+            if (fd >= 0 && sock_timeout(fd, SERVER_TIMEOUT_MS) != 0) {
+                close(fd);
+                fd = -1;
+            }
+            if (fd >= 0 && nfds == cap) {
+                struct pollfd *more = realloc(fds, sizeof(struct pollfd) * 2 * cap);
+                if (more) {
+                    fds = more;
+                    cap *= 2;
+                }
+            }
+            if (fd >= 0 && nfds < cap)
+                fds[nfds++] = (struct pollfd) { .fd = fd, .events = POLLIN };
+            else if (fd >= 0)
+                close(fd);
+        }
+    }
+
+    for (size_t k = 1; k < nfds; k++)
+        close(fds[k].fd);
+    free(fds);
+    close(lfd);
+    unlink(path);
+    sigaction(SIGINT, &old_int, NULL);
+    sigaction(SIGTERM, &old_term, NULL);
+
+    server_reset(&srv);
+    if (lux->ppm)
+        ppm_close(lux->ppm);
+    free(lux->depth);
+    lux->ppm = NULL;
+    lux->depth = NULL;
+    return err;
+}
+
+/*
+ * [server_call] have a render server render a frame
+ *   path: socket of the server
+ *   req: request; req->delta_size bytes of delta are sent along
+ *   delta: scene statements, may be NULL without delta
+ *   out: where the image goes
+ *   reply: the server's answer
+ * returns -1 if the server could not be reached; a refused request is
+ * reported through reply->status
+ */
+int server_call(const char *path, const server_request_t *req, const char *delta, FILE *out,
+                server_reply_t *reply)
+{
+    int fd = sock_connect(path);
+    if (fd < 0)
+        return -1;
+
+    int err = 0;
+    if (sock_write_full(fd, req, sizeof(server_request_t)) != 0
+        || (req->delta_size && sock_write_full(fd, delta, req->delta_size) != 0)
+        || sock_read_full(fd, reply, sizeof(server_reply_t)) != 0)
+        err = -1;
+
+    // copy the image through as it arrives
+    uint8_t buf[1 << 16];
+    for (uint64_t left = err ? 0 : reply->size; left > 0;) {
+        size_t n = left < sizeof(buf) ? left : sizeof(buf);
+        if (sock_read_full(fd, buf, n) != 0 || fwrite(buf, 1, n, out) != n) {
+            err = -1;
+            break;
+        }
+        left -= n;
+    }
+
+    close(fd);
+    return err;
+}
@@ -0,0 +1,55 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "lux.h"
+
+/* server_request_t flags */
+enum {
+    /* render from the camera of the request instead of the scene's */
+    SERVER_CAMERA = 1 << 0,
+    /* drop the deltas of earlier requests before applying this one's */
+    SERVER_RESET = 1 << 1,
+};
+
+/* server_reply_t status */
+enum {
+    SERVER_OK,
+    /* malformed request or unsupported resolution */
+    SERVER_BAD_REQUEST,
+    /* syntax error in the scene delta, see error_line */
+    SERVER_BAD_DELTA,
+    SERVER_RENDER_FAILED,
+};
+
+/* most pixels and delta bytes a request may ask for */
+#define SERVER_MAX_PIXELS (1 << 28)
+#define SERVER_MAX_DELTA (16 << 20)
+/* how long a client may leave a request or reply half transferred before it is dropped */
+#define SERVER_TIMEOUT_MS 5000
+
+/* a render request, followed by delta_size bytes of scene statements */
+typedef struct {
+    uint32_t width, height;
+    uint32_t flags;
+    uint32_t delta_size;
+    /* camera position, point looked at and fov, with SERVER_CAMERA */
+    double pos[3], target[3];
+    double fov;
+} server_request_t;
+
+/* the answer to a request, followed by size bytes of binary PPM image */
+typedef struct {
+    int32_t status;
+    /* line of the delta's first syntax error */
+    uint32_t error_line;
+    uint64_t size;
+    uint64_t primary_rays, shadow_rays;
+} server_reply_t;
+
+int lux_serve(lux_t *lux, const char *path);
+int server_call(const char *path, const server_request_t *req, const char *delta, FILE *out,
+                server_reply_t *reply);
+
+#endif
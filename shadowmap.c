@@ -0,0 +1,140 @@
+#include "shadowmap.h"
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include "bvh.h"
+#include "sched.h"
+
+/* rows of a face rendered by one task */
+#define SHADOW_BAND 16
+
+/* directions and up vectors of the cube faces, in the order of SHADOW_FACES */
+static const real_t face_dirs[SHADOW_FACES][2][3] = {
+    { { 1, 0, 0 }, { 0, 1, 0 } },
+    { { -1, 0, 0 }, { 0, 1, 0 } },
+    { { 0, 1, 0 }, { 0, 0, 1 } },
+    { { 0, -1, 0 }, { 0, 0, 1 } },
+    { { 0, 0, 1 }, { 0, 1, 0 } },
+    { { 0, 0, -1 }, { 0, 1, 0 } },
+};
+
+typedef struct {
+    lux_t *lux;
+    shadow_maps_t *maps;
+    size_t bands;
+} shadow_job_t;
+
+/* [light_pos] position of the light map m is for */
+static vec3 light_pos(const lux_t *lux, size_t m)
+{
+    return lux->light_num ? lux->lights[m].pos : lux->light;
+}
+
+/* [shadow_band_task] render SHADOW_BAND rows of one face of one map */
+static void shadow_band_task(void *ctx, size_t t, size_t worker)
+{
+    shadow_job_t *job = (shadow_job_t*) ctx;
+    shadow_maps_t *maps = job->maps;
+    size_t res = maps->res;
+    size_t band = t % job->bands, f = t / job->bands % SHADOW_FACES, m = t / job->bands / SHADOW_FACES;
+    shadow_map_t *map = &maps->maps[m];
+    (void) worker;
+
+    size_t j1 = (band + 1) * SHADOW_BAND < res ? (band + 1) * SHADOW_BAND : res;
+    for (size_t j = band * SHADOW_BAND; j < j1; j++) {
+        float *row = &map->depth[(f * res + j) * res];
+        for (size_t i = 0; i < res; i++) {
+            vec3 ray = camera_frame_ray(&map->frame[f], i, j);
+            hit_t hit = { .col.depth = FLT_MAX, .job = LUX_NO_HIT };
+            bvh_nearest(job->lux->bvh, map->pos, ray, &hit);
+            row[i] = hit.job != LUX_NO_HIT ? hit.col.depth : FLT_MAX;
+        }
+    }
+}
+
+/* [map_setup] point the face cameras of a map at its light and size its buffers */
+static int map_setup(shadow_map_t *map, vec3 pos, size_t res)
+{
+    map->pos = pos;
+    for (size_t f = 0; f < SHADOW_FACES; f++) {
+        camera_t *cam = &map->face[f];
+        cam->v = (vec3) { face_dirs[f][0][0], face_dirs[f][0][1], face_dirs[f][0][2] };
+        cam->u = (vec3) { face_dirs[f][1][0], face_dirs[f][1][1], face_dirs[f][1][2] };
+        cam->p = pos;
+        // the camera fov is half the angle covered: 45 makes the 90 degrees of a cube face
+        cam->fov = 45.0;
+        camera_invalidate(cam);
+        vec3_cross(cam->v, cam->u, &map->left[f]);
+        if (camera_frame_setup(&map->frame[f], cam, res, res) != 0)
+            return -1;
+    }
+
+    float *depth = realloc(map->depth, sizeof(float) * SHADOW_FACES * res * res);
+    if (!depth)
+        return -1;
+    map->depth = depth;
+    return 0;
+}
+
+/*
+ * [shadow_maps_update] render the shadow maps of every light, unless they are
+ * up to date
+ *   lux: lux context, committed, with shadow_map set
+ *   threads: render threads
+ *
+ * One map per light of the list, or one for the single light. Maps only depend
+ * on the hierarchy and the light positions, so camera moves reuse them.
+ */
+int shadow_maps_update(lux_t *lux, size_t threads)
+{
+    shadow_maps_t *maps = lux->shadow_maps;
+    size_t num = lux->light_num ? lux->light_num : 1;
+    size_t res = lux->shadow_map;
+
+    if (maps && maps->res == res && maps->bvh == lux->bvh->id && maps->map_num == num) {
+        size_t m;
+        for (m = 0; m < num; m++) {
+            vec3 p = light_pos(lux, m);
+            if (p.x != maps->maps[m].pos.x || p.y != maps->maps[m].pos.y || p.z != maps->maps[m].pos.z)
+                break;
+        }
+        if (m == num)
+            return 0;
+    }
+
+    if (!maps || maps->map_num != num) {
+        shadow_maps_free(maps);
+        if (!(maps = lux->shadow_maps = calloc(1, sizeof(shadow_maps_t)))
+            || !(maps->maps = calloc(num, sizeof(shadow_map_t))))
+            return -1;
+        maps->map_num = num;
+    }
+
+    // invalid until every map is rendered
+    maps->bvh = 0;
+    maps->res = res;
+    for (size_t m = 0; m < num; m++) {
+        if (map_setup(&maps->maps[m], light_pos(lux, m), res) != 0)
+            return -1;
+    }
+
+    shadow_job_t job = { .lux = lux, .maps = maps, .bands = (res + SHADOW_BAND - 1) / SHADOW_BAND };
+    if (sched_run(threads, num * SHADOW_FACES * job.bands, shadow_band_task, &job) != 0)
+        return -1;
+    lux->shadow_rays += num * SHADOW_FACES * res * res;
+    maps->bvh = lux->bvh->id;
+    return 0;
+}
+
+void shadow_maps_free(shadow_maps_t *maps)
+{
+    if (!maps)
+        return;
+    for (size_t m = 0; m < maps->map_num; m++) {
+        for (size_t f = 0; f < SHADOW_FACES; f++)
+            camera_frame_free(&maps->maps[m].frame[f]);
+        free(maps->maps[m].depth);
+    }
+    free(maps->maps);
+    free(maps);
+}
@@ -0,0 +1,90 @@
+#ifndef SHADOWMAP_H
+#define SHADOWMAP_H
+
+#include "lux.h"
+
+/* faces of a cube map: +x, -x, +y, -y, +z, -z */
+#define SHADOW_FACES 6
+
+/*
+ * Depth cube map around a light: each face is rendered like a square image
+ * through a 90 degree camera at the light, and holds the distance to the
+ * nearest surface along the ray through each pixel (FLT_MAX if none).
+ */
+typedef struct {
+    vec3 pos;
+    camera_t face[SHADOW_FACES];
+    /* left direction of each face camera, v x u */
+    vec3 left[SHADOW_FACES];
+    camera_frame_t frame[SHADOW_FACES];
+    /* pixel (i, j) of face f is at (f * res + j) * res + i */
+    float *depth;
+} shadow_map_t;
+
+/* one cube map per light, for the hierarchy they were rendered against */
+typedef struct shadow_maps {
+    size_t res;
+    uint64_t bvh;
+    shadow_map_t *maps;
+    size_t map_num;
+} shadow_maps_t;
+
+int shadow_maps_update(lux_t *lux, size_t threads);
+void shadow_maps_free(shadow_maps_t *maps);
+
+/* [shadow_texel] whether pixel (i, j) of face f, clamped to the face, saw nothing closer than depth */
+static inline real_t shadow_texel(const shadow_maps_t *maps, const shadow_map_t *map, size_t f, real_t i, real_t j, real_t depth)
+{
+    size_t last = maps->res - 1;
+    size_t x = i <= 0.0 ? 0 : i >= last ? last : (size_t) i;
+    size_t y = j <= 0.0 ? 0 : j >= last ? last : (size_t) j;
+    return map->depth[(f * maps->res + y) * maps->res + x] >= depth;
+}
+
+/*
+ * [shadow_map_visibility] how much of a light a point sees according to its map, 0 to 1
+ *   maps: shadow maps
+ *   m: map of the light
+ *   p: point
+ *   n: unit normal of the surface at p
+ *   bias: relative margin below which depths count as the same surface
+ *
+ * The point is first pushed off its surface by half a map pixel at its
+ * distance, which keeps surfaces seen at grazing angles from shadowing
+ * themselves. Pixels sit on the corners of the image plane grid, like the rays
+ * of camera_frame_ray; the four around the point are compared against it and
+ * their results blended bilinearly, which smooths the staircase of shadow edges.
+ */
+static inline real_t shadow_map_visibility(const shadow_maps_t *maps, size_t m, vec3 p, vec3 n, real_t bias)
+{
+    const shadow_map_t *map = &maps->maps[m];
+    vec3 d;
+    vec3_sub(p, map->pos, &d);
+    vec3_mul(n, vec3_norm(d) / maps->res, &n);
+    vec3_add(d, n, &d);
+
+    real_t ax = real_abs(d.x), ay = real_abs(d.y), az = real_abs(d.z);
+    size_t f;
+    if (ax >= ay && ax >= az)
+        f = d.x > 0.0 ? 0 : 1;
+    else if (ay >= az)
+        f = d.y > 0.0 ? 2 : 3;
+    else
+        f = d.z > 0.0 ? 4 : 5;
+
+    real_t a = vec3_dot(d, map->face[f].v);
+    if (!(a > 0.0))
+        return 1.0;
+    real_t half = 0.5 * maps->res;
+    real_t y = (1.0 - vec3_dot(d, map->face[f].u) / a) * half;
+    real_t x = (1.0 - vec3_dot(d, map->left[f]) / a) * half;
+    real_t x0 = floor(x), y0 = floor(y);
+    real_t fx = x - x0, fy = y - y0;
+
+    real_t depth = vec3_norm(d) * (1.0 - bias);
+    real_t top = (1.0 - fx) * shadow_texel(maps, map, f, x0, y0, depth) + fx * shadow_texel(maps, map, f, x0 + 1, y0, depth);
+    real_t bottom = (1.0 - fx) * shadow_texel(maps, map, f, x0, y0 + 1, depth) + fx * shadow_texel(maps, map, f, x0 + 1, y0 + 1, depth);
+    return (1.0 - fy) * top + fy * bottom;
+}
+
+#endif
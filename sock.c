@@ -0,0 +1,106 @@
+#include "sock.h"
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+/*
+ * Blocking stream socket helpers shared by the worker processes of
+ * lux_render_distributed and the render server.
+ */
+
+/* [sock_read_full] read exactly n bytes; end of stream before that is an error */
+int sock_read_full(int fd, void *buf, size_t n)
+{
+    uint8_t *at = buf;
+    while (n > 0) {
+        ssize_t r = read(fd, at, n);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return -1;
+        at += r;
+        n -= r;
+    }
+    return 0;
+}
+
+/* [sock_write_full] write n bytes; a closed peer is an error, not a SIGPIPE */
+int sock_write_full(int fd, const void *buf, size_t n)
+{
+    const uint8_t *at = buf;
+    while (n > 0) {
+        ssize_t r = send(fd, at, n, MSG_NOSIGNAL);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return -1;
+        at += r;
+        n -= r;
+    }
+    return 0;
+}
+
+/*
+ * [sock_timeout] make reads and writes on a socket give up after ms
+ * milliseconds without progress: sock_read_full and sock_write_full then fail
+ */
+int sock_timeout(int fd, unsigned ms)
+{
+    struct timeval tv = { .tv_sec = ms / 1000, .tv_usec = (ms % 1000) * 1000 };
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) != 0
+        || setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) != 0)
+        return -1;
+    return 0;
+}
+
+static int sock_address(const char *path, struct sockaddr_un *addr)
+{
+    memset(addr, 0, sizeof(struct sockaddr_un));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path))
+        return -1;
+    strcpy(addr->sun_path, path);
+    return 0;
+}
+
+/*
+ * [sock_listen] listening Unix stream socket, -1 on failure
+ *   path: socket path; a file left there by a previous run is replaced
+ */
+int sock_listen(const char *path)
+{
+    struct sockaddr_un addr;
+    if (sock_address(path, &addr) != 0)
+        return -1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    unlink(path);
+    if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0 || listen(fd, 16) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* [sock_connect] stream socket connected to the Unix socket at path, -1 on failure */
+int sock_connect(const char *path)
+{
+    struct sockaddr_un addr;
+    if (sock_address(path, &addr) != 0)
+        return -1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
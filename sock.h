@@ -0,0 +1,12 @@
+#ifndef SOCK_H
+#define SOCK_H
+
+#include <stddef.h>
+
+int sock_read_full(int fd, void *buf, size_t n);
+int sock_write_full(int fd, const void *buf, size_t n);
+int sock_timeout(int fd, unsigned ms);
+int sock_listen(const char *path);
+int sock_connect(const char *path);
+
+#endif
@@ -0,0 +1,135 @@
+#include "stats.h"
+
+#ifdef LUX_STATS
+
+#include <stdlib.h>
+#include "bvh.h"
+#include "geometry.h"
+#include "walk.h"
+
+_Thread_local stats_worker_t *stats_cur;
+
+static const char *phase_names[STATS_PHASES] = { "raygen", "intersect", "shade", "write" };
+
+static const char *job_type(const job_t *job)
+{
+    switch (job->kind) {
+    case JOB_SPHERE: return "sphere";
+    case JOB_PLANE: return "plane";
+    case JOB_WALL: return "wall";
+    case JOB_TRIANGLE: return "mesh";
+    default: break;
+    }
+    return "custom";
+}
+
+/*
+ * [stats_begin] allocate counters for one lux_render call
+ *   lux: lux context, committed
+ *   workers: number of worker threads
+ */
+stats_t *stats_begin(lux_t *lux, size_t workers)
+{
+    stats_t *stats = calloc(1, sizeof(stats_t));
+    stats->job_num = lux->bvh->job_num;
+    stats->worker_num = workers;
+    stats->workers = calloc(workers, sizeof(stats_worker_t));
+    for (size_t w = 0; w < workers; w++)
+        stats->workers[w].jobs = calloc(stats->job_num + 1, sizeof(stats_job_t));
+    stats->start = stats_now();
+    return stats;
+}
+
+/* [stats_enter] make the calling thread count into the counters of a worker */
+void stats_enter(stats_t *stats, size_t worker)
+{
+    stats_cur = stats ? &stats->workers[worker] : NULL;
+}
+
+/* [stats_tile] record the time a worker spent on a tile */
+void stats_tile(tile_t tile, size_t worker, double seconds)
+{
+    stats_worker_t *w = stats_cur;
+    if (!w)
+        return;
+    if (w->tile_num == w->tile_cap) {
+        w->tile_cap = w->tile_cap ? 2 * w->tile_cap : 64;
+        w->tiles = realloc(w->tiles, sizeof(stats_tile_t) * w->tile_cap);
+    }
+    w->tiles[w->tile_num++] = (stats_tile_t) { .tile = tile, .worker = worker, .seconds = seconds };
+}
+
+/*
+ * [stats_end] merge the workers' counters, dump them as JSON and free them
+ *   stats: counters of the call
+ *   lux: lux context; output goes to lux->stats_out, or stderr
+ */
+void stats_end(stats_t *stats, lux_t *lux)
+{
+    static uint64_t frames = 0;
+    FILE *f = lux->stats_out ? lux->stats_out : stderr;
+    double wall = stats_now() - stats->start;
+
+    stats_job_t *jobs = calloc(stats->job_num + 1, sizeof(stats_job_t));
+    double phase[STATS_PHASES] = { 0 };
+    for (size_t w = 0; w < stats->worker_num; w++) {
+        for (size_t j = 0; j < stats->job_num; j++) {
+            jobs[j].tests += stats->workers[w].jobs[j].tests;
+            jobs[j].hits += stats->workers[w].jobs[j].hits;
+            jobs[j].shadow_rays += stats->workers[w].jobs[j].shadow_rays;
+            jobs[j].shadow_occluded += stats->workers[w].jobs[j].shadow_occluded;
+        }
+        for (int p = 0; p < STATS_PHASES; p++)
+            phase[p] += stats->workers[w].phase[p];
+    }
+
+    // renders of a sequence finish concurrently: hold the stream so their lines do not mix
+    uint64_t frame = __atomic_fetch_add(&frames, 1, __ATOMIC_RELAXED);
+    flockfile(f);
+    fprintf(f, "{\"frame\": %llu, \"width\": %zu, \"height\": %zu, \"threads\": %zu, \"wall_ms\": %.3f, ",
+            (unsigned long long) frame, lux->ppm->width, lux->ppm->height, stats->worker_num, wall * 1e3);
+    fprintf(f, "\"schedule\": {\"tile_size\": %zu, \"order\": \"%s\", \"packet\": %zu}, ",
+            lux->tile_size ? lux->tile_size : LUX_TILE_SIZE, walk_order_name(lux->order), lux->packet);
+    fprintf(f, "\"primary_rays\": %llu, \"shadow_rays\": %llu, ",
+            (unsigned long long) lux->primary_rays, (unsigned long long) lux->shadow_rays);
+
+    fprintf(f, "\"jobs\": [");
+    for (size_t j = 0; j < stats->job_num; j++) {
+        fprintf(f, "%s{\"job\": %zu, \"type\": \"%s\", \"objects\": %zu, \"tests\": %llu, \"hits\": %llu, "
+                "\"shadow_rays\": %llu, \"shadow_occluded\": %llu}", j ? ", " : "",
+                j, job_type(&lux->bvh->jobs[j]), lux->bvh->jobs[j].obj_num,
+                (unsigned long long) jobs[j].tests, (unsigned long long) jobs[j].hits,
+                (unsigned long long) jobs[j].shadow_rays, (unsigned long long) jobs[j].shadow_occluded);
+    }
+
+    // phase times are summed over workers, so they add up to CPU time rather than wall time
+    fprintf(f, "], \"phase_ms\": {");
+    for (int p = 0; p < STATS_PHASES; p++)
+        fprintf(f, "%s\"%s\": %.3f", p ? ", " : "", phase_names[p], phase[p] * 1e3);
+
+    fprintf(f, "}, \"tiles\": [");
+    bool first = true;
+    for (size_t w = 0; w < stats->worker_num; w++) {
+        for (size_t t = 0; t < stats->workers[w].tile_num; t++) {
+            stats_tile_t *st = &stats->workers[w].tiles[t];
+            fprintf(f, "%s{\"x\": %zu, \"y\": %zu, \"w\": %zu, \"h\": %zu, \"worker\": %zu, \"ms\": %.4f}",
+                    first ? "" : ", ", st->tile.x0, st->tile.y0, st->tile.x1 - st->tile.x0,
+                    st->tile.y1 - st->tile.y0, st->worker, st->seconds * 1e3);
+            first = false;
+        }
+    }
+    fprintf(f, "]}\n");
+    fflush(f);
+    funlockfile(f);
+
+    for (size_t w = 0; w < stats->worker_num; w++) {
+        free(stats->workers[w].jobs);
+        free(stats->workers[w].tiles);
+    }
+    free(stats->workers);
+    free(stats);
+    free(jobs);
+    stats_cur = NULL;
+}
+
+#endif
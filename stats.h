@@ -0,0 +1,90 @@
+#ifndef STATS_H
+#define STATS_H
+
+/*
+ * Optional render statistics, compiled in with -DLUX_STATS (see the stats
+ * target of the Makefile). Without it every STATS_* macro expands to nothing
+ * and none of this code is built.
+ *
+ * Each worker thread counts into its own stats_worker_t, reached through a
+ * thread-local pointer, so counting never synchronizes. lux_render merges the
+ * workers and dumps one JSON object per call.
+ */
+
+#ifdef LUX_STATS
+
+#include <stdio.h>
+#include <time.h>
+#include "lux.h"
+
+enum {
+    STATS_RAYGEN,
+    STATS_INTERSECT,
+    STATS_SHADE,
+    STATS_WRITE,
+    STATS_PHASES
+};
+
+/* counters of one job */
+typedef struct {
+    uint64_t tests, hits;
+    /* shadow rays cast from objects of the job, and how many were blocked */
+    uint64_t shadow_rays, shadow_occluded;
+} stats_job_t;
+
+typedef struct {
+    tile_t tile;
+    size_t worker;
+    double seconds;
+} stats_tile_t;
+
+typedef struct {
+    stats_job_t *jobs;
+    /* seconds spent in each phase */
+    double phase[STATS_PHASES];
+    stats_tile_t *tiles;
+    size_t tile_num, tile_cap;
+} stats_worker_t;
+
+typedef struct stats {
+    size_t job_num, worker_num;
+    stats_worker_t *workers;
+    double start;
+} stats_t;
+
+extern _Thread_local stats_worker_t *stats_cur;
+
+static inline double stats_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+stats_t *stats_begin(lux_t *lux, size_t workers);
+void stats_enter(stats_t *stats, size_t worker);
+void stats_tile(tile_t tile, size_t worker, double seconds);
+void stats_end(stats_t *stats, lux_t *lux);
+
+#define STATS(x) x
+#define STATS_TEST(job, n) do { if (stats_cur) stats_cur->jobs[job].tests += (n); } while (0)
+#define STATS_HIT(job) do { if (stats_cur) stats_cur->jobs[job].hits++; } while (0)
+#define STATS_SHADOW(job, occluded) do { if (stats_cur) { \
+        stats_cur->jobs[job].shadow_rays++; stats_cur->jobs[job].shadow_occluded += (occluded); } } while (0)
+/* start a stopwatch, then charge the time since the last lap to a phase */
+#define STATS_CLOCK(t) double t = stats_now()
+#define STATS_LAP(p, t) do { double _now = stats_now(); \
+        if (stats_cur) { stats_cur->phase[p] += _now - t; } t = _now; } while (0)
+
+#else
+
+#define STATS(x)
+#define STATS_TEST(job, n) ((void) 0)
+#define STATS_HIT(job) ((void) 0)
+#define STATS_SHADOW(job, occluded) ((void) 0)
+#define STATS_CLOCK(t)
+#define STATS_LAP(p, t) ((void) 0)
+
+#endif
+
+#endif
@@ -2,20 +2,89 @@
 #define VEC3_H
 
 #include <stdbool.h>
+#include <math.h>
+#include <float.h>
+
+/*
+ * Scalar type of the whole renderer: double by default, float when built with
+ * -DLUX_FLOAT (see the float target of the Makefile).
+ */
+#ifdef LUX_FLOAT
+typedef float real_t;
+#define REAL_MAX FLT_MAX
+#define real_sqrt sqrtf
+#define real_abs fabsf
+#define real_min fminf
+#define real_max fmaxf
+#else
+typedef double real_t;
+#define REAL_MAX DBL_MAX
+#define real_sqrt sqrt
+#define real_abs fabs
+#define real_min fmin
+#define real_max fmax
+#endif
 
 typedef struct {
-    double x, y, z;
+    real_t x, y, z;
 } vec3;
 
 void vec3_print(vec3 v);
-void vec3_add(vec3 a, vec3 b, vec3 *res);
-void vec3_sub(vec3 a, vec3 b, vec3 *res);
-void vec3_mul(vec3 a, double s, vec3 *res);
-void vec3_cross(vec3 a, vec3 b, vec3 *res);
-double vec3_dot(vec3 a, vec3 b);
 bool vec3_eq(vec3 a, vec3 b);
-double vec3_norm(vec3 a);
-void vec3_normalize(vec3 a, vec3 *res);
+
+/*
+ * The arithmetic helpers are defined here so they inline into the render loops
+ * of every translation unit.
+ */
+
+static inline void vec3_add(vec3 a, vec3 b, vec3 *res)
+{
+    res->x = a.x + b.x;
+    res->y = a.y + b.y;
+    res->z = a.z + b.z;
+}
+
+static inline void vec3_sub(vec3 a, vec3 b, vec3 *res)
+{
+    res->x = a.x - b.x;
+    res->y = a.y - b.y;
+    res->z = a.z - b.z;
+}
+
+static inline void vec3_mul(vec3 a, real_t s, vec3 *res)
+{
+    res->x = s * a.x;
+    res->y = s * a.y;
+    res->z = s * a.z;
+}
+
+static inline void vec3_cross(vec3 a, vec3 b, vec3 *res)
+{
+    vec3 c = {
+        a.y * b.z - a.z * b.y,
+        a.z * b.x - a.x * b.z,
+        a.x * b.y - a.y * b.x,
+    };
+    *res = c;
+}
+
+static inline real_t vec3_dot(vec3 a, vec3 b)
+{
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+static inline real_t vec3_norm(vec3 a)
+{
+    return real_sqrt(a.x*a.x + a.y*a.y + a.z*a.z);
+}
+
+static inline void vec3_normalize(vec3 a, vec3 *res)
+{
+    real_t norm = vec3_norm(a);
+    res->x = a.x / norm;
+    res->y = a.y / norm;
+    res->z = a.z / norm;
+}
 
 #define VEC3_UNPACK(v) v.x, v.y, v.z
 
@@ -0,0 +1,114 @@
+#ifndef WALK_H
+#define WALK_H
+
+#include <string.h>
+#include "lux.h"
+
+/*
+ * Walks over the pixels of a tile in the order of a pixel_order_t. Curves
+ * are laid over the smallest power-of-two square holding the tile, and their
+ * points outside of it skipped, so tiles of any size are covered, each pixel
+ * once. Along a curve, consecutive pixels stay close in both directions and
+ * their rays meet the same hierarchy nodes and objects, still in cache, where
+ * rows cross the whole tile before coming back next to where they started.
+ */
+typedef struct {
+    tile_t tile;
+    pixel_order_t order;
+    /* edge of the curve's square */
+    size_t side;
+    /* next point of the curve, and past the last one */
+    size_t d, end;
+} walk_t;
+
+/* [walk_morton] point d of the Z-order curve: x and y are the even and odd bits of d */
+static inline void walk_morton(size_t d, size_t *x, size_t *y)
+{
+    uint64_t v[2] = { d, d >> 1 };
+    for (size_t k = 0; k < 2; k++) {
+        v[k] &= 0x5555555555555555ULL;
+        v[k] = (v[k] | (v[k] >> 1)) & 0x3333333333333333ULL;
+        v[k] = (v[k] | (v[k] >> 2)) & 0x0f0f0f0f0f0f0f0fULL;
+        v[k] = (v[k] | (v[k] >> 4)) & 0x00ff00ff00ff00ffULL;
+        v[k] = (v[k] | (v[k] >> 8)) & 0x0000ffff0000ffffULL;
+        v[k] = (v[k] | (v[k] >> 16)) & 0x00000000ffffffffULL;
+    }
+    *x = v[0];
+    *y = v[1];
+}
+
+/* [walk_hilbert] point d of the Hilbert curve over a side x side square, side a power of two */
+static inline void walk_hilbert(size_t side, size_t d, size_t *x, size_t *y)
+{
+    *x = *y = 0;
+    for (size_t s = 1; s < side; s *= 2, d /= 4) {
+        size_t rx = 1 & (d / 2), ry = 1 & (d ^ rx);
+        // rotate the quadrant so that its curve joins its neighbours'
+        if (ry == 0) {
+            if (rx == 1) {
+                *x = s - 1 - *x;
+                *y = s - 1 - *y;
+            }
+            size_t t = *x;
+            *x = *y;
+            *y = t;
+        }
+        *x += s * rx;
+        *y += s * ry;
+    }
+}
+
+/* [walk_tile] start a walk over the pixels of a tile */
+static inline walk_t walk_tile(tile_t tile, pixel_order_t order)
+{
+    size_t tw = tile.x1 - tile.x0, th = tile.y1 - tile.y0;
+    walk_t walk = { .tile = tile, .order = order, .side = 1 };
+    while (walk.side < tw || walk.side < th)
+        walk.side *= 2;
+    walk.end = order == ORDER_ROWS ? tw * th : walk.side * walk.side;
+    return walk;
+}
+
+/* [walk_next] next pixel (i, j) of a walk, false once every pixel was visited */
+static inline bool walk_next(walk_t *walk, size_t *i, size_t *j)
+{
+    size_t tw = walk->tile.x1 - walk->tile.x0, th = walk->tile.y1 - walk->tile.y0;
+
+    while (walk->d < walk->end) {
+        size_t x, y, d = walk->d++;
+        switch (walk->order) {
+        case ORDER_MORTON: walk_morton(d, &x, &y); break;
+        case ORDER_HILBERT: walk_hilbert(walk->side, d, &x, &y); break;
+        default: x = d % tw; y = d / tw; break;
+        }
+        if (x < tw && y < th) {
+            *i = walk->tile.x0 + x;
+            *j = walk->tile.y0 + y;
+            return true;
+        }
+    }
+    return false;
+}
+
+static inline const char *walk_order_name(pixel_order_t order)
+{
+    switch (order) {
+    case ORDER_MORTON: return "morton";
+    case ORDER_HILBERT: return "hilbert";
+    default: return "rows";
+    }
+}
+
+/* [walk_order_parse] pixel order from its name, -1 if unknown */
+static inline int walk_order_parse(const char *name, pixel_order_t *order)
+{
+    for (int o = ORDER_ROWS; o <= ORDER_HILBERT; o++) {
+        if (strcmp(name, walk_order_name(o)) == 0) {
+            *order = o;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+#endif
@@ -0,0 +1,388 @@
+#include "wavefront.h"
+#include <stdlib.h>
+#include <float.h>
+#include "bvh.h"
+#include "path.h"
+#include "shadowmap.h"
+#include "walk.h"
+
+/*
+ * Wavefront path tracing: instead of following each path to its end, the
+ * paths of a tile advance together, one stage at a time over queues of rays
+ * stored a component per array:
+ *
+ *   generate   camera rays of a batch of paths into the ray queue
+ *   intersect  the whole queue against the hierarchy
+ *   sort       the hits by primitive type (counting sort)
+ *   shade      each type's hits with a kernel of its own: surface normals
+ *              inlined, lights gathered into the shadow queue, and the
+ *              bounces of the paths that go on into the next ray queue
+ *   occlude    the whole shadow queue, adding up the light that gets through
+ *
+ * then intersect again with the bounces until no path is left. Each stage is
+ * a tight loop over one kind of work, which keeps the code and data it
+ * touches small, and each shading kernel only sees one type of surface.
+ *
+ * Paths are numbered pixel by pixel, pixels taken in lux->order, and a
+ * pixel's paths are added up in that order once their batch is done. With per-path random streams
+ * (path_stream) and the steps of path.h, this renders exactly the image the
+ * path-at-a-time tracer does.
+ */
+
+/* paths in flight at once in a tile */
+#define WAVE_PATHS 4096
+
+/* rays of a stage, one array per component */
+typedef struct {
+    real_t *ox, *oy, *oz;
+    real_t *dx, *dy, *dz;
+    /* how far the ray may go */
+    real_t *tmax;
+    /* path the ray belongs to */
+    uint32_t *path;
+    /* what a shadow ray brings when nothing blocks it, unused for the others */
+    real_t *r, *g, *b;
+    size_t n, cap;
+} ray_queue_t;
+
+/* a path in flight */
+typedef struct {
+    rng_t rng;
+    vec3 throughput;
+    /* throughput the light reaching the current surface is weighted by */
+    vec3 weight;
+    /* light reaching the current surface */
+    vec3 direct;
+    /* light carried back so far */
+    vec3 sum;
+    uint32_t bounce;
+} wave_path_t;
+
+typedef struct {
+    lux_t *lux;
+    tile_t tile;
+    size_t max_depth;
+    real_t cutoff;
+    wave_path_t *paths;
+    /* tile pixels (y * width + x) in the order they are visited */
+    uint32_t *visit;
+    /* tile pixel of each path of the batch */
+    uint32_t *pixel;
+    ray_queue_t rays, next, shadow;
+    /* nearest hit of each ray of the queue and the queue sorted by primitive type */
+    hit_t *hits;
+    uint32_t *order;
+    /* paths shaded in the current stage */
+    uint32_t *shaded;
+    size_t shaded_num;
+    /* depth each pixel started with, clipping its camera rays, and sum of its paths */
+    float *clip;
+    vec3 *sums;
+    size_t nearest, shadow_rays;
+} wave_t;
+
+/* [queue_alloc] room for WAVE_PATHS rays, with their contributions for shadow rays */
+static int queue_alloc(ray_queue_t *q, bool shadow)
+{
+    real_t **reals[] = { &q->ox, &q->oy, &q->oz, &q->dx, &q->dy, &q->dz, &q->tmax, &q->r, &q->g, &q->b };
+    size_t num = shadow ? 10 : 7;
+    for (size_t k = 0; k < num; k++) {
+        if (!(*reals[k] = malloc(sizeof(real_t) * WAVE_PATHS)))
+            return -1;
+    }
+    q->path = malloc(sizeof(uint32_t) * WAVE_PATHS);
+    q->cap = WAVE_PATHS;
+    return q->path ? 0 : -1;
+}
+
+static void queue_free(ray_queue_t *q)
+{
+    free(q->ox); free(q->oy); free(q->oz);
+    free(q->dx); free(q->dy); free(q->dz);
+    free(q->tmax);
+    free(q->r); free(q->g); free(q->b);
+    free(q->path);
+}
+
+static inline void queue_push(ray_queue_t *q, vec3 o, vec3 d, real_t tmax, uint32_t path)
+{
+    size_t k = q->n++;
+    q->ox[k] = o.x; q->oy[k] = o.y; q->oz[k] = o.z;
+    q->dx[k] = d.x; q->dy[k] = d.y; q->dz[k] = d.z;
+    q->tmax[k] = tmax;
+    q->path[k] = path;
+}
+
+/* [wave_occlude] trace the shadow queue, adding up the light getting through to each path */
+static void wave_occlude(wave_t *w)
+{
+    ray_queue_t *s = &w->shadow;
+    for (size_t r = 0; r < s->n; r++) {
+        vec3 source = { s->ox[r], s->oy[r], s->oz[r] };
+        vec3 dir = { s->dx[r], s->dy[r], s->dz[r] };
+        if (lux_occluded(w->lux, source, dir, s->tmax[r]))
+            continue;
+        vec3 *direct = &w->paths[s->path[r]].direct;
+        vec3_add(*direct, ((vec3) { s->r[r], s->g[r], s->b[r] }), direct);
+    }
+    w->shadow_rays += s->n;
+    s->n = 0;
+}
+
+/* [shadow_push] queue a shadow ray from surface point p to a light bringing c */
+static void shadow_push(wave_t *w, vec3 p, vec3 target, vec3 c, uint32_t path)
+{
+    // a full queue is traced on the spot: a path's lights still add up in order
+    ray_queue_t *q = &w->shadow;
+    if (q->n == q->cap)
+        wave_occlude(w);
+
+    vec3 source, dir;
+    real_t max_t = path_shadow_ray(p, target, &source, &dir);
+    q->r[q->n] = c.x;
+    q->g[q->n] = c.y;
+    q->b[q->n] = c.z;
+    queue_push(q, source, dir, max_t, path);
+}
+
+/* [wave_lights] queue shadow rays towards the lights of a surface point, or look them up in the shadow maps */
+static void wave_lights(wave_t *w, wave_path_t *path, uint32_t id, vec3 p, vec3 n)
+{
+    lux_t *lux = w->lux;
+
+    if (lux->light_num == 0) {
+        real_t cos = path_scene_light(lux, p, n);
+        if (cos <= 0.0)
+            return;
+        if (lux->shadow_map) {
+            real_t vis = shadow_map_visibility(lux->shadow_maps, 0, p, n, lux_shadow_bias(lux));
+            path->direct = (vec3) { cos * vis, cos * vis, cos * vis };
+        } else {
+            shadow_push(w, p, lux->light, (vec3) { cos, cos, cos }, id);
+        }
+        return;
+    }
+
+    const light_grid_t *grid = &lux->light_grid;
+    const uint32_t *near = NULL;
+    size_t near_num = light_grid_cell(grid, p, &near);
+
+    for (size_t k = 0; k < grid->unbounded_num + near_num; k++) {
+        uint32_t l = k < grid->unbounded_num ? grid->unbounded[k] : near[k - grid->unbounded_num];
+        const light_t *light = &lux->lights[l];
+        real_t wl = path_light(light, p, n, w->cutoff);
+        if (wl == 0.0)
+            continue;
+
+        vec3 c;
+        if (lux->shadow_map) {
+            wl *= shadow_map_visibility(lux->shadow_maps, l, p, n, lux_shadow_bias(lux));
+            vec3_mul(light->color, wl, &c);
+            vec3_add(path->direct, c, &path->direct);
+        } else {
+            vec3_mul(light->color, wl, &c);
+            shadow_push(w, p, light->pos, c, id);
+        }
+    }
+}
+
+/*
+ * [shade_as] shading kernel of the hits on one type of primitive
+ *   w: wavefront state
+ *   order: queue indices of the hits, all on jobs of type kind
+ *   n: number of hits
+ *   kind: primitive type, a constant in every caller
+ */
+static inline __attribute__((always_inline))
+void shade_as(wave_t *w, const uint32_t *order, size_t n, job_kind_t kind)
+{
+    const ray_queue_t *q = &w->rays;
+    const job_t *jobs = w->lux->bvh->jobs;
+
+    for (size_t k = 0; k < n; k++) {
+        uint32_t r = order[k];
+        uint32_t id = q->path[r];
+        wave_path_t *path = &w->paths[id];
+        const hit_t *hit = &w->hits[r];
+        vec3 origin = { q->ox[r], q->oy[r], q->oz[r] };
+        vec3 ray = { q->dx[r], q->dy[r], q->dz[r] };
+
+        vec3 p, nrm;
+        path_surface(kind, &jobs[hit->job], hit, origin, ray, &p, &nrm);
+
+        path->throughput.x *= hit->col.color.x;
+        path->throughput.y *= hit->col.color.y;
+        path->throughput.z *= hit->col.color.z;
+        path->weight = path->throughput;
+        path->direct = (vec3) { 0.0, 0.0, 0.0 };
+        w->shaded[w->shaded_num++] = id;
+        wave_lights(w, path, id, p, nrm);
+
+        if (path->bounce == w->max_depth
+            || (path->bounce >= LUX_PATH_ROULETTE && !path_roulette(&path->rng, &path->throughput)))
+            continue;
+
+        // leave from just above the surface
+        path->bounce++;
+        vec3 dir = path_bounce(&path->rng, nrm);
+        vec3_mul(nrm, 0.001, &origin);
+        vec3_add(p, origin, &origin);
+        queue_push(&w->next, origin, dir, FLT_MAX, id);
+    }
+}
+
+/* [wave_stage] intersect, sort, shade and occlude the rays of the queue; the bounces end up in w->next */
+static void wave_stage(wave_t *w)
+{
+    lux_t *lux = w->lux;
+    ray_queue_t *q = &w->rays;
+    size_t tw = w->tile.x1 - w->tile.x0;
+    size_t count[JOB_TRIANGLE + 1] = { 0 };
+
+    for (size_t r = 0; r < q->n; r++) {
+        hit_t *hit = &w->hits[r];
+        *hit = (hit_t) { .col.depth = q->tmax[r], .job = LUX_NO_HIT };
+        vec3 origin = { q->ox[r], q->oy[r], q->oz[r] };
+        vec3 ray = { q->dx[r], q->dy[r], q->dz[r] };
+        if (!bvh_nearest(lux->bvh, origin, ray, hit))
+            continue;
+        count[lux->bvh->jobs[hit->job].kind]++;
+
+        // camera rays leave the nearest of their hits in the depth buffer
+        uint32_t id = q->path[r];
+        if (w->paths[id].bounce == 0) {
+            size_t px = w->pixel[id];
+            float *depth = lux_depth_at(lux, w->tile.x0 + px % tw, w->tile.y0 + px / tw);
+            if (hit->col.depth < *depth)
+                *depth = hit->col.depth;
+        }
+    }
+    w->nearest += q->n;
+
+    size_t start[JOB_TRIANGLE + 1];
+    size_t at = 0;
+    for (size_t k = 0; k <= JOB_TRIANGLE; k++) {
+        start[k] = at;
+        at += count[k];
+    }
+    for (size_t r = 0; r < q->n; r++) {
+        if (w->hits[r].job != LUX_NO_HIT)
+            w->order[start[lux->bvh->jobs[w->hits[r].job].kind]++] = r;
+    }
+
+    // start[k] now ends bin k
+    w->next.n = 0;
+    w->shaded_num = 0;
+    shade_as(w, w->order, count[JOB_GENERIC], JOB_GENERIC);
+    shade_as(w, w->order + start[JOB_GENERIC], count[JOB_PLANE], JOB_PLANE);
+    shade_as(w, w->order + start[JOB_PLANE], count[JOB_WALL], JOB_WALL);
+    shade_as(w, w->order + start[JOB_WALL], count[JOB_SPHERE], JOB_SPHERE);
+    shade_as(w, w->order + start[JOB_SPHERE], count[JOB_TRIANGLE], JOB_TRIANGLE);
+    wave_occlude(w);
+
+    for (size_t k = 0; k < w->shaded_num; k++) {
+        wave_path_t *path = &w->paths[w->shaded[k]];
+        path->sum.x += path->weight.x * path->direct.x;
+        path->sum.y += path->weight.y * path->direct.y;
+        path->sum.z += path->weight.z * path->direct.z;
+    }
+
+    ray_queue_t tmp = w->rays;
+    w->rays = w->next;
+    w->next = tmp;
+}
+
+/* [wave_batch] trace paths [g0, g1) of the tile, path g being path g % samples of visited pixel g / samples */
+static void wave_batch(wave_t *w, size_t g0, size_t g1)
+{
+    lux_t *lux = w->lux;
+    size_t samples = lux->path_samples;
+    size_t tw = w->tile.x1 - w->tile.x0;
+
+    w->rays.n = 0;
+    for (size_t g = g0; g < g1; g++) {
+        uint32_t id = g - g0;
+        size_t px = w->visit[g / samples];
+        size_t i = w->tile.x0 + px % tw, j = w->tile.y0 + px / tw;
+        wave_path_t *path = &w->paths[id];
+        rng_seed(&path->rng, lux->seed, path_stream(lux, i, j, g % samples));
+        path->throughput = (vec3) { 1.0, 1.0, 1.0 };
+        path->sum = (vec3) { 0.0, 0.0, 0.0 };
+        path->bounce = 0;
+        w->pixel[id] = px;
+        queue_push(&w->rays, lux->camera.p, path_primary(lux, &path->rng, i, j), w->clip[px], id);
+    }
+
+    while (w->rays.n > 0)
+        wave_stage(w);
+
+    for (size_t g = g0; g < g1; g++)
+        vec3_add(w->sums[w->pixel[g - g0]], w->paths[g - g0].sum, &w->sums[w->pixel[g - g0]]);
+}
+
+/*
+ * [wave_tile] path trace lux->path_samples paths through every pixel of a
+ * tile in stages; same image as path_tile
+ *   lux: lux context, committed and with its shadow maps up to date
+ *   tile: pixel block, inside the ppm window
+ *   nearest: incremented by the number of nearest-hit rays traced
+ *   shadow: incremented by the number of shadow rays cast
+ * returns -1, with nothing rendered, if memory runs out
+ */
+int wave_tile(lux_t *lux, tile_t tile, size_t *nearest, size_t *shadow)
+{
+    size_t tw = tile.x1 - tile.x0, th = tile.y1 - tile.y0;
+    wave_t w = {
+        .lux = lux,
+        .tile = tile,
+        .max_depth = lux->path_depth ? lux->path_depth : LUX_PATH_DEPTH,
+        .cutoff = lux->light_cutoff > 0 ? lux->light_cutoff : LUX_LIGHT_CUTOFF,
+        .paths = malloc(sizeof(wave_path_t) * WAVE_PATHS),
+        .visit = malloc(sizeof(uint32_t) * tw * th),
+        .pixel = malloc(sizeof(uint32_t) * WAVE_PATHS),
+        .hits = malloc(sizeof(hit_t) * WAVE_PATHS),
+        .order = malloc(sizeof(uint32_t) * WAVE_PATHS),
+        .shaded = malloc(sizeof(uint32_t) * WAVE_PATHS),
+        .clip = malloc(sizeof(float) * tw * th),
+        .sums = calloc(tw * th, sizeof(vec3)),
+    };
+
+    int err = !w.paths || !w.visit || !w.pixel || !w.hits || !w.order || !w.shaded || !w.clip || !w.sums
+        || queue_alloc(&w.rays, false) != 0 || queue_alloc(&w.next, false) != 0
+        || queue_alloc(&w.shadow, true) != 0;
+
+    if (!err) {
+        for (size_t px = 0; px < tw * th; px++)
+            w.clip[px] = *lux_depth_at(lux, tile.x0 + px % tw, tile.y0 + px / tw);
+
+        walk_t walk = walk_tile(tile, lux->order);
+        size_t i, j, v = 0;
+        while (walk_next(&walk, &i, &j))
+            w.visit[v++] = (j - tile.y0) * tw + (i - tile.x0);
+
+        size_t paths = tw * th * lux->path_samples;
+        for (size_t g0 = 0; g0 < paths; g0 += WAVE_PATHS)
+            wave_batch(&w, g0, g0 + WAVE_PATHS < paths ? g0 + WAVE_PATHS : paths);
+
+        for (size_t px = 0; px < tw * th; px++)
+            path_write(lux, tile.x0 + px % tw, tile.y0 + px / tw, w.sums[px]);
+    }
+
+    free(w.paths);
+    free(w.visit);
+    free(w.pixel);
+    free(w.hits);
+    free(w.order);
+    free(w.shaded);
+    free(w.clip);
+    free(w.sums);
+    queue_free(&w.rays);
+    queue_free(&w.next);
+    queue_free(&w.shadow);
+
+    if (err)
+        return -1;
+    *nearest += w.nearest;
+    *shadow += w.shadow_rays;
+    return 0;
+}
@@ -0,0 +1,8 @@
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include "lux.h"
+
+int wave_tile(lux_t *lux, tile_t tile, size_t *nearest, size_t *shadow);
+
+#endif